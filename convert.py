@@ -1,26 +1,146 @@
 from xml.etree import ElementTree
+import math
 import os
 import re
+import sys
 
 
-def path_to_lines(unicode, path):
+# A glyph is a list of strokes, drawn with the pen down. A stroke is a list of elements, each a tuple of
+# the element kind, its end point and its control points:
+#   ("M", end)                  the start of the stroke, always the first element
+#   ("L", end)                  straight line
+#   ("Q", end, control)         quadratic bezier
+#   ("C", end, control1, control2)  cubic bezier
+#   ("A+", end, center)         circular arc, counter clockwise (positive angles) from the previous end point
+#   ("A-", end, center)         circular arc, clockwise
+# Elliptical arcs are converted to cubic beziers.
+
+def arc_to_center(x1, y1, rx, ry, phi, large_arc, sweep, x2, y2):
+    # Endpoint to center parameterization, SVG 1.1 implementation notes F.6.5 and F.6.6.
+    cos_phi, sin_phi = math.cos(phi), math.sin(phi)
+    dx, dy = (x1 - x2) / 2, (y1 - y2) / 2
+    x1p = cos_phi * dx + sin_phi * dy
+    y1p = -sin_phi * dx + cos_phi * dy
+    rx, ry = abs(rx), abs(ry)
+    scale = (x1p * x1p) / (rx * rx) + (y1p * y1p) / (ry * ry)
+    if scale > 1:
+        rx, ry = rx * math.sqrt(scale), ry * math.sqrt(scale)
+    numerator = rx * rx * ry * ry - rx * rx * y1p * y1p - ry * ry * x1p * x1p
+    denominator = rx * rx * y1p * y1p + ry * ry * x1p * x1p
+    factor = math.sqrt(max(0.0, numerator / denominator)) if denominator else 0.0
+    if large_arc == sweep:
+        factor = -factor
+    cxp, cyp = factor * rx * y1p / ry, -factor * ry * x1p / rx
+    cx = cos_phi * cxp - sin_phi * cyp + (x1 + x2) / 2
+    cy = sin_phi * cxp + cos_phi * cyp + (y1 + y2) / 2
+    theta1 = math.atan2((y1p - cyp) / ry, (x1p - cxp) / rx)
+    theta2 = math.atan2((-y1p - cyp) / ry, (-x1p - cxp) / rx)
+    dtheta = theta2 - theta1
+    if sweep and dtheta < 0:
+        dtheta += 2 * math.pi
+    elif not sweep and dtheta > 0:
+        dtheta -= 2 * math.pi
+    return cx, cy, rx, ry, theta1, dtheta
+
+
+def arc_elements(start, rx, ry, phi, large_arc, sweep, end):
+    if start == end:
+        return []
+    if rx == 0 or ry == 0:
+        return [("L", end)]
+    cx, cy, rx, ry, theta1, dtheta = arc_to_center(*start, rx, ry, phi, large_arc, sweep, *end)
+    if abs(rx - ry) <= max(rx, ry) * 1e-3:
+        return [("A+" if dtheta > 0 else "A-", end, (cx, cy))]
+    # Elliptical arc, approximate with a cubic bezier per quarter turn at most.
+    count = max(1, math.ceil(abs(dtheta) / (math.pi / 2) - 1e-9))
+    delta = dtheta / count
+    k = 4 / 3 * math.tan(delta / 4)
+    cos_phi, sin_phi = math.cos(phi), math.sin(phi)
+    point = lambda t: (cx + rx * math.cos(t) * cos_phi - ry * math.sin(t) * sin_phi, cy + rx * math.cos(t) * sin_phi + ry * math.sin(t) * cos_phi)
+    derivative = lambda t: (-rx * math.sin(t) * cos_phi - ry * math.cos(t) * sin_phi, -rx * math.sin(t) * sin_phi + ry * math.cos(t) * cos_phi)
+    result = []
+    for n in range(count):
+        t1, t2 = theta1 + n * delta, theta1 + (n + 1) * delta
+        p1, p2 = point(t1), point(t2)
+        d1, d2 = derivative(t1), derivative(t2)
+        control1 = (p1[0] + k * d1[0], p1[1] + k * d1[1])
+        control2 = (p2[0] - k * d2[0], p2[1] - k * d2[1])
+        result.append(("C", end if n == count - 1 else p2, control1, control2))
+    return result
+
+
+def path_to_strokes(unicode, path):
     if path is None:
         return []
-    # print(path)
     result = []
     current = None
+    position = (0.0, 0.0)
+    last_control = None
+    last_control_kind = None
     for m in re.finditer(r"([A-Za-z])([^A-Za-z]*)", path):
         cmd, params = m.groups()
-        params = tuple(float(p) for p in params.replace(",", " ").split())
-        if cmd == "M":
-            assert len(params) == 2
-            current = [params]
-            result.append(current)
-        elif cmd == "L":
-            assert len(params) == 2
-            current.append(params)
-        else:
+        params = [float(p) for p in re.findall(r"[-+]?(?:\d*\.\d+|\d+\.?)(?:[eE][-+]?\d+)?", params)]
+        relative = cmd.islower()
+        cmd = cmd.upper()
+        counts = {"M": 2, "L": 2, "H": 1, "V": 1, "Q": 4, "T": 2, "C": 6, "S": 4, "A": 7, "Z": 0}
+        if cmd not in counts:
             raise RuntimeError(f"Unsupported SVG path command: {cmd} {params} ({unicode})")
+        count = counts[cmd]
+        if cmd == "Z":
+            if current and position != current[0][1]:
+                current.append(("L", current[0][1]))
+            if current:
+                position = current[0][1]
+            last_control = None
+            last_control_kind = None
+            continue
+        if len(params) % count != 0 or not params:
+            raise RuntimeError(f"Wrong number of parameters for SVG path command: {cmd} {params} ({unicode})")
+        for idx in range(0, len(params), count):
+            p = params[idx:idx + count]
+            point = lambda x, y: (position[0] + x, position[1] + y) if relative else (x, y)
+            control = None
+            if cmd == "M":
+                position = point(*p)
+                current = [("M", position)]
+                result.append(current)
+                # Further coordinate pairs of a moveto are implicit linetos.
+                cmd = "L"
+            elif cmd == "L":
+                position = point(*p)
+                current.append(("L", position))
+            elif cmd == "H":
+                position = (position[0] + p[0] if relative else p[0], position[1])
+                current.append(("L", position))
+            elif cmd == "V":
+                position = (position[0], position[1] + p[0] if relative else p[0])
+                current.append(("L", position))
+            elif cmd in "QT":
+                if cmd == "Q":
+                    control = point(p[0], p[1])
+                    end = point(p[2], p[3])
+                else:
+                    control = (2 * position[0] - last_control[0], 2 * position[1] - last_control[1]) if last_control_kind == "Q" else position
+                    end = point(p[0], p[1])
+                current.append(("Q", end, control))
+                position = end
+            elif cmd in "CS":
+                if cmd == "C":
+                    control1 = point(p[0], p[1])
+                    control = point(p[2], p[3])
+                    end = point(p[4], p[5])
+                else:
+                    control1 = (2 * position[0] - last_control[0], 2 * position[1] - last_control[1]) if last_control_kind == "C" else position
+                    control = point(p[0], p[1])
+                    end = point(p[2], p[3])
+                current.append(("C", end, control1, control))
+                position = end
+            elif cmd == "A":
+                end = point(p[5], p[6])
+                current += arc_elements(position, p[0], p[1], math.radians(p[2]), p[3] != 0, p[4] != 0, end)
+                position = end
+            last_control = control
+            last_control_kind = "Q" if cmd in "QT" else "C" if cmd in "CS" else None
     return result
 
 
@@ -35,10 +155,101 @@ def process(filename):
         path = e.attrib.get('d')
         if unicode is None or ord(unicode) > 128:
             continue
-        glyphs[unicode] = (float(e.attrib.get('horiz-adv-x')), path_to_lines(unicode, path))
+        glyphs[unicode] = (float(e.attrib.get('horiz-adv-x')), path_to_strokes(unicode, path))
     return glyphs
 
 
+def reverse_stroke(stroke):
+    # The same stroke, drawn from its end to its start.
+    result = [("M", stroke[-1][1])]
+    for idx in range(len(stroke) - 1, 0, -1):
+        kind, end, *controls = stroke[idx]
+        if kind == "C":
+            controls = controls[::-1]
+        elif kind in ("A+", "A-"):
+            kind = "A-" if kind == "A+" else "A+"
+        result.append((kind, stroke[idx - 1][1], *controls))
+    return result
+
+
+def travel_distance(strokes, advance):
+    # Pen up travel of plotting the strokes in order, from the glyph origin to the start of the next glyph.
+    distance = 0.0
+    position = (0, 0)
+    for stroke in strokes:
+        distance += math.dist(position, stroke[0][1])
+        position = stroke[-1][1]
+    return distance + math.dist(position, (advance, 0))
+
+
+def merge_strokes(strokes):
+    # Join strokes that end where another one starts, flipping them where needed, so the pen stays down.
+    strokes = list(strokes)
+    merged = True
+    while merged:
+        merged = False
+        for a in range(len(strokes)):
+            for b in range(len(strokes)):
+                if a == b:
+                    continue
+                if strokes[a][-1][1] == strokes[b][-1][1]:
+                    strokes[b] = reverse_stroke(strokes[b])
+                elif strokes[a][0][1] == strokes[b][0][1]:
+                    strokes[a] = reverse_stroke(strokes[a])
+                elif strokes[a][0][1] == strokes[b][-1][1]:
+                    strokes[a], strokes[b] = strokes[b], strokes[a]
+                if strokes[a][-1][1] == strokes[b][0][1]:
+                    strokes[a] = strokes[a] + strokes[b][1:]
+                    del strokes[b]
+                    merged = True
+                    break
+            if merged:
+                break
+    return strokes
+
+
+def order_strokes(strokes, advance):
+    # Nearest neighbour ordering with flipping, improved by 2-opt: reversing a run of strokes also flips each of them.
+    remaining = list(strokes)
+    result = []
+    position = (0, 0)
+    while remaining:
+        best = min(remaining, key=lambda stroke: min(math.dist(position, stroke[0][1]), math.dist(position, stroke[-1][1])))
+        remaining.remove(best)
+        if math.dist(position, best[-1][1]) < math.dist(position, best[0][1]):
+            best = reverse_stroke(best)
+        result.append(best)
+        position = best[-1][1]
+    improved = True
+    while improved:
+        improved = False
+        for i in range(len(result)):
+            for j in range(i, len(result)):
+                candidate = result[:i] + [reverse_stroke(stroke) for stroke in reversed(result[i:j + 1])] + result[j + 1:]
+                if travel_distance(candidate, advance) < travel_distance(result, advance) - 1e-6:
+                    result = candidate
+                    improved = True
+    return result
+
+
+def optimize_strokes(name, glyphs):
+    before = 0.0
+    after = 0.0
+    optimized = {}
+    for unicode, (advance, strokes) in glyphs.items():
+        # Compare points as they are stored, see encode_glyph().
+        strokes = [[(kind, *((int(x), int(y)) for x, y in points)) for kind, *points in stroke] for stroke in strokes]
+        # A lone moveto is a dot: keep it as a zero length line so it still gets a pen down and up.
+        strokes = [stroke if len(stroke) > 1 else stroke + [("L", stroke[0][1])] for stroke in strokes]
+        before += travel_distance(strokes, advance)
+        strokes = order_strokes(merge_strokes(strokes), advance)
+        after += travel_distance(strokes, advance)
+        optimized[unicode] = (advance, strokes)
+    stroke_count = lambda g: sum(len(strokes) for advance, strokes in g.values())
+    print(f"  {name}: pen up travel {before:.0f} -> {after:.0f} units, {stroke_count(glyphs)} -> {stroke_count(optimized)} strokes")
+    return optimized
+
+
 class Dumper:
     def __init__(self, filename):
         self.__f = open(filename, "wt")
@@ -53,11 +264,15 @@ class Dumper:
         if characters is None:
             characters = glyphs.keys()
         for character in characters:
-            advance, lines = glyphs[character]
-            for line in lines:
-                for idx, (x, y) in enumerate(line):
-                    self.__f.write("M" if idx == 0 else "L")
-                    self.__f.write(f'{x/SCALE+offset} {self.__offset_y-y/SCALE} ')
+            advance, strokes = glyphs[character]
+            for stroke in strokes:
+                for kind, *points in stroke:
+                    # Arcs are dumped as a line to their end point.
+                    if kind in ("A+", "A-"):
+                        kind, points = "L", points[:1]
+                    self.__f.write(kind)
+                    for x, y in points[1:] + points[:1]:
+                        self.__f.write(f'{x/SCALE+offset} {self.__offset_y-y/SCALE} ')
             offset += advance/SCALE
         self.__offset_y += 1250 / self.__scale
 
@@ -66,63 +281,148 @@ class Dumper:
         self.__f.write('</svg>')
 
 
+def encode_varint(value):
+    result = bytearray()
+    while value >= 0x80:
+        result.append((value & 0x7F) | 0x80)
+        value >>= 7
+    result.append(value)
+    return result
+
+
+def zigzag(value):
+    # Zigzag encoding, so small negative deltas are small varints as well.
+    return (value << 1) if value >= 0 else ((-value << 1) - 1)
+
+
+def encode_signed(value):
+    return encode_varint(zigzag(value))
+
+
+ELEMENT_TYPES = {"L": 0, "Q": 1, "C": 2, "A+": 3, "A-": 4}
+
+
+def encode_glyph(strokes):
+    # Per stroke: varint element count, then the start point as zigzag varint x and y deltas from the previous
+    # end point. Then per element a varint header of (zigzag x delta << 1) | curve flag and the zigzag y delta
+    # of the end point. Curves follow with a varint element type and their control points (the center of
+    # arcs) as deltas from the start of the element, so lines cost a single bit more than plain points.
+    # The first point of the glyph is relative to 0,0. An element count of 0 ends the glyph.
+    result = bytearray()
+    px, py = 0, 0
+    for stroke in strokes:
+        result += encode_varint(len(stroke))
+        x, y = stroke[0][1]
+        result += encode_signed(x - px)
+        result += encode_signed(y - py)
+        px, py = x, y
+        for kind, (x, y), *controls in stroke[1:]:
+            result += encode_varint((zigzag(x - px) << 1) | (kind != "L"))
+            result += encode_signed(y - py)
+            if kind != "L":
+                result += encode_varint(ELEMENT_TYPES[kind])
+                for cx, cy in controls:
+                    result += encode_signed(cx - px)
+                    result += encode_signed(cy - py)
+            px, py = x, y
+    result += encode_varint(0)
+    return result
+
+
+def font_name_hash(name):
+    # 32 bit FNV-1a
+    h = 2166136261
+    for c in name.encode():
+        h = ((h ^ c) * 16777619) & 0xFFFFFFFF
+    return h
+
+
 class Exporter:
     def __init__(self, filename):
         self.__all_fonts = []
         self.__f = open(filename, "wt")
         self.__f.write("""#include <stdint.h>
 
-static constexpr int16_t _END_OF_LINE = 0x7FFF;
+static constexpr uint8_t _NO_GLYPH = 0xFF;
 
+// Glyph data is packed in a byte pool per font, see encode_glyph() in convert.py.
 struct Glyph {
-    uint16_t codepoint;
     uint16_t advance;
-    const int16_t* lines;
+    uint16_t offset;             // Offset of the strokes of this glyph in the data of the font
 };
 struct Font {
     const char* name;
+    const uint8_t* data;
     const Glyph* glyphs;
+    uint8_t first_codepoint;
+    uint8_t codepoint_count;
+    const uint8_t* glyph_index;  // Index in glyphs for each codepoint from first_codepoint, _NO_GLYPH if missing
 };
 """)
 
     def store(self, name: str, glyphs):
         symbol = name.lower()
-        for unicode, (advance, lines) in glyphs.items():
-            self.__f.write(f"static const int16_t _font_glyph_{symbol}_{ord(unicode)}[] = {{")
-            for line in lines:
-                for x, y in line:
-                    self.__f.write(f"{int(x)},{int(y)},")
-                self.__f.write(f"_END_OF_LINE,")
-            self.__f.write(f"_END_OF_LINE,")
-            self.__f.write(f"}};\n")
+        data = bytearray()
+        offsets = []
+        for unicode, (advance, strokes) in glyphs.items():
+            offsets.append(len(data))
+            data += encode_glyph(strokes)
+        assert len(data) < 0x10000, f"{name} does not fit 16 bit glyph offsets"
+        curves = sum(1 for advance, strokes in glyphs.values() for stroke in strokes for element in stroke if element[0] not in ("M", "L"))
+        print(f"  {len(data)} bytes of glyph data, {curves} curves")
+        self.__f.write(f"static const uint8_t _font_data_{symbol}[] = {{{','.join(str(b) for b in data)}}};\n")
         self.__f.write(f"static const Glyph _font_glyphs_{symbol}[] = {{\n")
-        for unicode, (advance, lines) in glyphs.items():
-            self.__f.write(f"  {{{ord(unicode)}, {int(advance)}, _font_glyph_{symbol}_{ord(unicode)}}},\n")
-        self.__f.write(f"  {{0, 0, nullptr}},\n")
+        for (unicode, (advance, strokes)), offset in zip(glyphs.items(), offsets):
+            self.__f.write(f"  {{{int(advance)}, {offset}}},\n")
         self.__f.write(f"}};\n")
-        self.__f.write(f"static const Font _font_{symbol} = {{\"{name}\", _font_glyphs_{symbol}}};\n")
-        self.__all_fonts.append(symbol)
+        # Dense table from codepoint to glyph, so a lookup is a single index. Only ASCII is converted, so this stays small.
+        codepoints = [ord(unicode) for unicode in glyphs.keys()]
+        first = min(codepoints, default=0)
+        count = max(codepoints, default=-1) - first + 1
+        assert first < 256 and count < 256 and len(codepoints) < 255
+        index = ["_NO_GLYPH"] * count
+        for idx, codepoint in enumerate(codepoints):
+            index[codepoint - first] = str(idx)
+        self.__f.write(f"static const uint8_t _font_glyph_index_{symbol}[] = {{{','.join(index)},}};\n")
+        self.__f.write(f"static const Font _font_{symbol} = {{\"{name}\", _font_data_{symbol}, _font_glyphs_{symbol}, {first}, {count}, _font_glyph_index_{symbol}}};\n")
+        self.__all_fonts.append((name, symbol))
 
     def __del__(self):
         self.__f.write(f"static const Font* _all_fonts[] = {{\n")
-        for symbol in self.__all_fonts:
+        for name, symbol in self.__all_fonts:
             self.__f.write(f"  &_font_{symbol},\n")
         self.__f.write(f"  nullptr,\n")
         self.__f.write(f"}};\n")
+        # Open addressing hash table of the font names, at most half full. Must match font_name_hash() in fonts.cpp.
+        size = 1
+        while size < len(self.__all_fonts) * 2:
+            size *= 2
+        table = ["nullptr"] * size
+        for name, symbol in self.__all_fonts:
+            slot = font_name_hash(name) & (size - 1)
+            while table[slot] != "nullptr":
+                slot = (slot + 1) & (size - 1)
+            table[slot] = f"&_font_{symbol}"
+        self.__f.write(f"static constexpr unsigned int _font_table_size = {size};\n")
+        self.__f.write(f"static const Font* _font_table[_font_table_size] = {{{','.join(table)}}};\n")
 
 
-def main():
+def main(args):
+    # Without arguments all fonts in svg-fonts/fonts go into fonts.inc, otherwise: convert.py <output> <font.svg>...
+    if args:
+        output, filenames = args[0], args[1:]
+    else:
+        output, filenames = "fonts.inc", []
+        for path, dirs, files in os.walk(os.path.join(os.path.dirname(__file__), "svg-fonts/fonts")):
+            filenames += [os.path.join(path, file) for file in files if file.endswith(".svg")]
     # d = Dumper("dump.svg")
-    e = Exporter("fonts.inc")
-    for path, dirs, files in os.walk(os.path.join(os.path.dirname(__file__), "svg-fonts/fonts")):
-        for file in files:
-            if file.endswith(".svg"):
-                if file == "TwinSans.svg":  # Skip this font which has curves in the ascii set
-                    continue
-                glyphs = process(os.path.join(path, file))
-                # d.dump(glyphs, file)
-                e.store(os.path.splitext(file)[0], glyphs)
+    e = Exporter(output)
+    for filename in filenames:
+        name = os.path.splitext(os.path.basename(filename))[0]
+        glyphs = optimize_strokes(name, process(filename))
+        # d.dump(glyphs, filename)
+        e.store(name, glyphs)
 
 
 if __name__ == "__main__":
-    main()
+    main(sys.argv[1:])
@@ -2,5 +2,7 @@
 
 
 void pen_init();
+// Start moving the pen. Returns immediately and is safe to call from the step interrupt,
+// the time the pen needs to settle is PEN_UP_SETTLE_TIME_US/PEN_DOWN_SETTLE_TIME_US in config/pen.h.
 void pen_up();
-void pen_down();
\ No newline at end of file
+void pen_down();
@@ -1,33 +1,35 @@
 #include "arch/pen.h"
-#include <stdio.h>
 #include <hardware/gpio.h>
+#include <hardware/pwm.h>
+#include <hardware/clocks.h>
 #include <pico/stdlib.h>
 
 static constexpr uint32_t pen_pin = 14;
+static constexpr uint32_t servo_period_us = 20000;
+static constexpr uint32_t pen_up_pulse_us = 1300;
+static constexpr uint32_t pen_down_pulse_us = 2000;
 
+// The servo pulse is generated by the PWM hardware, so pen changes only set a level and return
+// immediately. They are called from the step interrupt, which waits the settle time in config/pen.h.
 void pen_init()
 {
-    gpio_init(pen_pin);
-    gpio_set_dir(pen_pin, true);
+    gpio_set_function(pen_pin, GPIO_FUNC_PWM);
+    uint slice = pwm_gpio_to_slice_num(pen_pin);
+    pwm_config config = pwm_get_default_config();
+    // Count in microseconds, wrapping every servo period.
+    pwm_config_set_clkdiv(&config, float(clock_get_hz(clk_sys)) / 1000000.0f);
+    pwm_config_set_wrap(&config, servo_period_us - 1);
+    pwm_init(slice, &config, false);
     pen_up();
-}
-
-static void update_servo(uint32_t delay_us)
-{
-    for(int n=0; n<15; n++) {
-        gpio_put(pen_pin, true);
-        sleep_us(delay_us);
-        gpio_put(pen_pin, false);
-        sleep_us(20000 - delay_us);
-    }
+    pwm_set_enabled(slice, true);
 }
 
 void pen_up()
 {
-    update_servo(1300);
+    pwm_set_gpio_level(pen_pin, pen_up_pulse_us);
 }
 
 void pen_down()
 {
-    update_servo(2000);
+    pwm_set_gpio_level(pen_pin, pen_down_pulse_us);
 }
@@ -1,9 +1,9 @@
 #include "arch/stepperMotor.h"
 #include "config/planner.h"
+#include "config/stepper.h"
 #include "stdio.h"
 #include <assert.h>
 #include <hardware/gpio.h>
-#include <hardware/irq.h>
 #include <pico/time.h>
 #include <pico/stdlib.h>
 #include <stdio.h>
@@ -42,17 +42,7 @@ void stepper_motors_init(InterruptFunctionPtr interrupt_function)
     gpio_set_dir(step1_pin, true);
 
     stepper_interrupt = interrupt_function;
-    add_repeating_timer_us(1000, &timer_callback, nullptr, &stepper_timer);
-}
-
-void stepper_motors_interrupt_disable()
-{
-    irq_set_enabled(TIMER_IRQ_3, false);
-}
-
-void stepper_motors_interrupt_enable()
-{
-    irq_set_enabled(TIMER_IRQ_3, true);
+    add_repeating_timer_us(-1000, &timer_callback, nullptr, &stepper_timer);
 }
 
 void stepper_motors_disable()
@@ -65,9 +55,11 @@ void stepper_motors_enable()
     gpio_put(enable_pin, false);
 }
 
+// A negative delay makes the SDK time the next tick from the start of this one, not from the end of the callback,
+// so the time spent in the step interrupt does not stretch the interval.
 void stepper_motors_set_interval(unsigned int interval_us)
 {
-    stepper_timer.delay_us = interval_us;
+    stepper_timer.delay_us = -int64_t(interval_us);
 }
 
 void stepper_motors_set_direction(int index, bool active)
@@ -85,3 +77,8 @@ void stepper_motors_set_step_pulse(int index, bool active)
     else
         gpio_put(step1_pin, active);
 }
+
+void stepper_motors_pulse_wait()
+{
+    busy_wait_us_32(STEPPER_PULSE_US);
+}
@@ -0,0 +1,20 @@
+#include "arch/input.h"
+#include "simulation.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+
+void input_init()
+{
+}
+
+// Characters to plot are read from stdin. The simulation ends at the end of the input.
+char input_getchar()
+{
+    int c = getchar();
+    if (c == EOF) {
+        sim_report();
+        exit(0);
+    }
+    return c;
+}
@@ -1,5 +1,5 @@
 #include "arch/pen.h"
-#include <stdio.h>
+#include "simMotors.h"
 
 void pen_init()
 {
@@ -8,10 +8,15 @@ void pen_init()
 
 void pen_up()
 {
-    printf("pen up\n");
+    sim_motors.pen_up();
 }
 
 void pen_down()
 {
-    printf("pen down\n");
+    sim_motors.pen_down();
+}
+
+unsigned int sim_pen_changes()
+{
+    return sim_motors.pen_changes();
 }
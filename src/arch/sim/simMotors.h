@@ -0,0 +1,135 @@
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include "simulation.h"
+
+// Simulated motors and pen with their own virtual clock, see simulation.h. The sim_* and stepper_motors_* functions
+// use a default instance, more instances simulate more machines side by side, each driven by its own Stepper.
+template<int AXES> class SimMotors
+{
+public:
+    // Write the step trace with sim_trace_*(), only the default instance does this.
+    bool trace = false;
+
+    // Current time of the virtual clock in microseconds.
+    uint64_t time_us() const { return clock_us; }
+
+    // Advance the virtual clock by delay_us, firing the step interrupt at every timer deadline on the way.
+    // Only the step interrupt changes machine state, so this always advances up to at least the next interrupt.
+    void advance(uint64_t delay_us)
+    {
+        uint64_t target_us = clock_us + delay_us;
+        if (!interrupt_function) {
+            clock_us = target_us;
+            return;
+        }
+        if (target_us < next_interrupt_us)
+            target_us = next_interrupt_us;
+        while(next_interrupt_us <= target_us) {
+            clock_us = next_interrupt_us;
+            interrupt_function(interrupt_context);
+            if (trace)
+                trace_interrupt_steps();
+            // Like the repeating timer, an interval set from the interrupt applies to the next period.
+            next_interrupt_us = clock_us + interval_us;
+        }
+        clock_us = target_us;
+    }
+
+    // Call the step interrupt without the virtual clock.
+    void interrupt() { interrupt_function(interrupt_context); }
+
+    // Number of pen up/down changes so far.
+    unsigned int pen_changes() const { return pen_change_count; }
+    // Number of steps done on an axis so far, in either direction.
+    unsigned int axis_steps(int index) const
+    {
+        assert(index >= 0 && index < AXES);
+        return steps[index];
+    }
+
+    // The motor interface of Stepper.
+    void attach(void (*function)(void*), void* context)
+    {
+        interrupt_function = function;
+        interrupt_context = context;
+        next_interrupt_us = clock_us + interval_us;
+    }
+
+    void set_interval(unsigned int new_interval_us)
+    {
+        interval_us = new_interval_us;
+    }
+
+    void set_direction(int index, bool active)
+    {
+        assert(index >= 0 && index < AXES);
+        direction[index] = active;
+    }
+
+    void set_step_pulse(int index, bool active)
+    {
+        assert(index >= 0 && index < AXES);
+        if (active) {
+            position[index] += direction[index] ? -1 : 1;
+            steps[index]++;
+            if (trace)
+                interrupt_steps[index]++;
+        }
+    }
+
+    // The step interrupt takes no time on the virtual clock, so neither does the step pulse.
+    void pulse_wait()
+    {
+    }
+
+    // The pen does not take time itself, the stepper waits the settle time after a pen change on the virtual clock.
+    void pen_up()
+    {
+        pen_change_count++;
+        if (trace)
+            sim_trace_pen(clock_us, false);
+    }
+
+    void pen_down()
+    {
+        pen_change_count++;
+        if (trace)
+            sim_trace_pen(clock_us, true);
+    }
+
+private:
+    void trace_interrupt_steps()
+    {
+        if constexpr (AXES == OUTPUT_AXIS_COUNT) {
+            uint8_t direction_bits = 0;
+            bool stepped = false;
+            for(int n=0; n<AXES; n++) {
+                if (direction[n])
+                    direction_bits |= 1 << n;
+                if (interrupt_steps[n])
+                    stepped = true;
+            }
+            if (stepped) {
+                sim_trace_steps(clock_us, interrupt_steps, direction_bits);
+                for(auto& count : interrupt_steps)
+                    count = 0;
+            }
+        }
+    }
+
+    bool direction[AXES] = {};
+    int position[AXES] = {};
+    unsigned int steps[AXES] = {};
+    uint8_t interrupt_steps[AXES] = {};         // Step events per axis during the current interrupt, for the trace
+    unsigned int interval_us = 1000;
+    void (*interrupt_function)(void*) = nullptr;
+    void* interrupt_context = nullptr;
+    unsigned int pen_change_count = 0;
+
+    uint64_t clock_us = 0;
+    uint64_t next_interrupt_us = 0;
+};
+
+extern SimMotors<OUTPUT_AXIS_COUNT> sim_motors;
@@ -0,0 +1,13 @@
+#include "simulation.h"
+#include "config/planner.h"
+#include <stdio.h>
+
+
+void sim_report()
+{
+    sim_trace_close(sim_time_us());
+    printf("Simulated time: %.3f s\n", sim_time_us() / 1000000.0);
+    printf("Pen changes: %u\n", sim_pen_changes());
+    for(int n=0; n<OUTPUT_AXIS_COUNT; n++)
+        printf("Axis %d steps: %u\n", n, sim_axis_steps(n));
+}
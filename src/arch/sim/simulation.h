@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+#include "config/planner.h"
+#include "arch/stepperMotor.h"
+
+// The sim arch is a discrete event simulation of the machine. It keeps a virtual clock, which only moves
+// forward through arch_sleep() and the simulated pen, and fires the step interrupt at the virtual times
+// the hardware timer would. This runs far faster than real time, so the simulated time predicts job durations.
+
+// Current time of the virtual clock in microseconds.
+uint64_t sim_time_us();
+// Advance the virtual clock by delay_us, firing the step interrupt at every timer deadline on the way.
+// Only the step interrupt changes machine state, so this always advances up to at least the next interrupt.
+void sim_advance(uint64_t delay_us);
+// The step interrupt registered by stepper_motors_init(), so benchmarks can call it without the virtual clock.
+InterruptFunctionPtr sim_step_interrupt();
+
+// Number of pen up/down changes so far.
+unsigned int sim_pen_changes();
+// Number of steps done on an axis so far, in either direction.
+unsigned int sim_axis_steps(int index);
+
+// Print the simulated job duration and statistics. Also closes the step trace.
+void sim_report();
+
+// Binary step trace, see traceFormat.h. Written when the PENPLOTTER_TRACE environment variable names a file.
+void sim_trace_open(const char* filename);
+void sim_trace_steps(uint64_t time_us, const uint8_t (&steps)[OUTPUT_AXIS_COUNT], uint8_t direction_bits);
+void sim_trace_pen(uint64_t time_us, bool down);
+void sim_trace_close(uint64_t time_us);
@@ -1,9 +1,7 @@
 #include "arch/sleep.h"
-
-void sim_run_interrupts();
+#include "simulation.h"
 
 void arch_sleep(unsigned int delay_us)
 {
-    (void)delay_us;
-    sim_run_interrupts();
-}
\ No newline at end of file
+    sim_advance(delay_us);
+}
@@ -1,32 +1,45 @@
 #include "arch/stepperMotor.h"
-#include "config/planner.h"
-#include "stdio.h"
-#include <assert.h>
+#include "simMotors.h"
+#include <stdlib.h>
 
 
-static bool sim_direction[OUTPUT_AXIS_COUNT];
-static int sim_position[OUTPUT_AXIS_COUNT];
-static unsigned int timer_interval_us;
+SimMotors<OUTPUT_AXIS_COUNT> sim_motors;
+
 static InterruptFunctionPtr sim_interrupt_function;
 
-void sim_run_interrupts()
+static void sim_interrupt_trampoline(void*)
 {
-    if (sim_interrupt_function)
-        sim_interrupt_function();
-    printf("%d %d %d\n", sim_position[0], sim_position[1], timer_interval_us);
+    sim_interrupt_function();
 }
 
-void stepper_motors_init(InterruptFunctionPtr interrupt_function)
+uint64_t sim_time_us()
 {
-    sim_interrupt_function = interrupt_function;
+    return sim_motors.time_us();
+}
+
+void sim_advance(uint64_t delay_us)
+{
+    sim_motors.advance(delay_us);
+}
+
+InterruptFunctionPtr sim_step_interrupt()
+{
+    return sim_interrupt_function;
 }
 
-void stepper_motors_interrupt_disable()
+unsigned int sim_axis_steps(int index)
 {
+    return sim_motors.axis_steps(index);
 }
 
-void stepper_motors_interrupt_enable()
+void stepper_motors_init(InterruptFunctionPtr interrupt_function)
 {
+    sim_interrupt_function = interrupt_function;
+    sim_motors.attach(sim_interrupt_trampoline, nullptr);
+    if (const char* trace_filename = getenv("PENPLOTTER_TRACE")) {
+        sim_trace_open(trace_filename);
+        sim_motors.trace = true;
+    }
 }
 
 void stepper_motors_disable()
@@ -39,18 +52,20 @@ void stepper_motors_enable()
 
 void stepper_motors_set_interval(unsigned int interval_us)
 {
-    timer_interval_us = interval_us;
+    sim_motors.set_interval(interval_us);
 }
 
 void stepper_motors_set_direction(int index, bool active)
 {
-    assert(index >= 0 && index < OUTPUT_AXIS_COUNT);
-    sim_direction[index] = active;
+    sim_motors.set_direction(index, active);
 }
 
 void stepper_motors_set_step_pulse(int index, bool active)
 {
-    assert(index >= 0 && index < OUTPUT_AXIS_COUNT);
-    if (active)
-        sim_position[index] += sim_direction[index] ? -1 : 1;
+    sim_motors.set_step_pulse(index, active);
+}
+
+void stepper_motors_pulse_wait()
+{
+    sim_motors.pulse_wait();
 }
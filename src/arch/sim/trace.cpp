@@ -0,0 +1,127 @@
+#include "simulation.h"
+#include "traceFormat.h"
+#include "config/stepper.h"
+#include <stdio.h>
+#include <string.h>
+
+
+// Enough bits per axis to count STEPPER_MAX_STEPS_PER_INTERRUPT step events.
+static constexpr unsigned int step_bits = STEPPER_MAX_STEPS_PER_INTERRUPT < 4 ? 2 : STEPPER_MAX_STEPS_PER_INTERRUPT < 8 ? 3 : 4;
+static constexpr unsigned int max_run_ticks = 1024;
+
+static FILE* trace_file;
+static uint8_t buffer[64 * 1024];
+static size_t buffer_used;
+static uint64_t last_time_us;
+static uint8_t last_direction_bits;
+
+// The run of step ticks that is not written yet
+static unsigned int run_ticks;
+static uint64_t run_delta_us;
+static uint8_t run_steps[(max_run_ticks * OUTPUT_AXIS_COUNT * step_bits + 7) / 8];
+
+static void flush()
+{
+    fwrite(buffer, 1, buffer_used, trace_file);
+    buffer_used = 0;
+}
+
+static void put(uint8_t value)
+{
+    if (buffer_used == sizeof(buffer))
+        flush();
+    buffer[buffer_used++] = value;
+}
+
+static void put_varint(uint64_t value)
+{
+    while(value >= 0x80) {
+        put(uint8_t(value) | 0x80);
+        value >>= 7;
+    }
+    put(uint8_t(value));
+}
+
+static void write_run()
+{
+    if (!run_ticks)
+        return;
+    put(TRACE_STEPS);
+    put_varint(run_delta_us);
+    put_varint(run_ticks);
+    for(size_t n=0; n<(run_ticks * OUTPUT_AXIS_COUNT * step_bits + 7) / 8; n++)
+        put(run_steps[n]);
+    run_ticks = 0;
+}
+
+void sim_trace_open(const char* filename)
+{
+    trace_file = fopen(filename, "wb");
+    if (!trace_file) {
+        perror(filename);
+        return;
+    }
+    const float steps_per_unit[OUTPUT_AXIS_COUNT] = DEFAULT_AXIS_STEPS_PER_UNIT;
+    for(auto c : trace_magic)
+        put(c);
+    put(trace_version);
+    put(OUTPUT_AXIS_COUNT);
+    put(step_bits);
+    for(auto f : steps_per_unit) {
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        for(int n=0; n<4; n++)
+            put(bits >> (n * 8));
+    }
+}
+
+void sim_trace_steps(uint64_t time_us, const uint8_t (&steps)[OUTPUT_AXIS_COUNT], uint8_t direction_bits)
+{
+    if (!trace_file)
+        return;
+    uint64_t delta_us = time_us - last_time_us;
+    last_time_us = time_us;
+    if (direction_bits != last_direction_bits) {
+        write_run();
+        put(TRACE_DIRECTION);
+        put(direction_bits);
+        last_direction_bits = direction_bits;
+    }
+    if (run_ticks == max_run_ticks || (run_ticks && delta_us != run_delta_us))
+        write_run();
+    if (!run_ticks) {
+        run_delta_us = delta_us;
+        memset(run_steps, 0, sizeof(run_steps));
+    }
+    for(size_t n=0; n<OUTPUT_AXIS_COUNT; n++) {
+        unsigned int bit = (run_ticks * OUTPUT_AXIS_COUNT + n) * step_bits;
+        unsigned int value = steps[n] << (bit % 8);
+        run_steps[bit / 8] |= value;
+        if (value >> 8)
+            run_steps[bit / 8 + 1] |= value >> 8;
+    }
+    run_ticks++;
+}
+
+void sim_trace_pen(uint64_t time_us, bool down)
+{
+    if (!trace_file)
+        return;
+    write_run();
+    put(TRACE_PEN);
+    put_varint(time_us - last_time_us);
+    put(down ? 1 : 0);
+    last_time_us = time_us;
+}
+
+void sim_trace_close(uint64_t time_us)
+{
+    if (!trace_file)
+        return;
+    write_run();
+    put(TRACE_END);
+    put_varint(time_us - last_time_us);
+    flush();
+    fclose(trace_file);
+    trace_file = nullptr;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+// Binary step trace written by the simulation, read by the penplotter_trace tool.
+//
+// Header:
+//   "PPTR", uint8 version, uint8 axis count, uint8 bits per axis step count,
+//   then a little endian float32 steps/mm per axis.
+// Records, each starting with a record type byte. Times are varint deltas in microseconds
+// since the previous timed record:
+//   TRACE_STEPS:     varint delta, varint tick count, then per tick and axis the number of step
+//                    events in that interrupt, packed LSB first. All ticks in a run are delta apart.
+//   TRACE_DIRECTION: uint8 direction bits, applies to the following steps. Bit set is the negative direction.
+//   TRACE_PEN:       varint delta, uint8 1 for pen down, 0 for pen up.
+//   TRACE_END:       varint delta to the end of the simulation.
+// Varints are 7 bits per byte, least significant first, high bit set when more bytes follow.
+
+static constexpr char trace_magic[4] = {'P', 'P', 'T', 'R'};
+static constexpr uint8_t trace_version = 1;
+
+enum TraceRecord : uint8_t
+{
+    TRACE_STEPS = 1,
+    TRACE_DIRECTION = 2,
+    TRACE_PEN = 3,
+    TRACE_END = 4,
+};
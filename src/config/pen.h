@@ -0,0 +1,13 @@
+#pragma once
+
+
+// Time the servo needs to move the pen after a pen change. Pen changes do not block, instead the motion after
+// a pen change waits this long. Tune this to the servo and pen holder, too short smears the start of strokes.
+#define PEN_UP_SETTLE_TIME_US         150000
+#define PEN_DOWN_SETTLE_TIME_US       150000
+
+// Pen lead: a pen change is started this long before the end of the move before it, so the servo moves while
+// the machine is still finishing that move. The settle time after the move is shortened by the same amount.
+// Only the last move before the pen change is used, a shorter move starts the pen change at its start.
+#define PEN_UP_LEAD_US                30000
+#define PEN_DOWN_LEAD_US              100000
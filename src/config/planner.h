@@ -19,7 +19,21 @@
 #define DEFAULT_XYJERK                1.0      // (mm/sec)
 #define DEFAULT_ZJERK                 0.1      // (mm/sec)
 
+// Define this to limit junction speeds with junction deviation (as Grbl does) instead of the max jerk above.
+// The corner speed then follows from the angle between the moves and the acceleration: the speed at which
+// a circle through the corner, JUNCTION_DEVIATION_MM away from it, can be followed at the acceleration.
+// Font curves are made of many short moves with small angles, which jerk limits to a crawl.
+// Off by default, so the shipped motion stays the max jerk cornering the machine was tuned with. Enabling it with
+// 0.02mm cut the simulated plot time of all printable ASCII by about 16% (penplotter_bench machine-time,
+// EMSHerculean text 378s -> 314s). Check it on the machine before turning it on.
+//#define PLANNER_JUNCTION_DEVIATION
+#define JUNCTION_DEVIATION_MM         0.02     // (mm)
+
 // Minimum planner junction speed. Sets the default minimum speed the planner plans for at the end
 // of the buffer and all stops. This should not be much greater than zero and should only be changed
 // if unwanted behavior is observed on a user's machine when running at very slow speeds.
 #define MINIMUM_PLANNER_SPEED 0.05// (mm/sec)
+
+// The RP2040 has no hardware FPU. Define this to run the planner math in fixed point instead of (soft)float.
+// See motion/fixedPoint.h for how far the results can differ from the float planner.
+//#define PLANNER_FIXED_POINT
@@ -0,0 +1,31 @@
+#pragma once
+
+
+// Number of prepared step segments queued for the step interrupt. Must be a power of 2.
+#define SEGMENT_BUFFER_SIZE           16
+// Target duration of a single step segment. The step rate changes once per segment while accelerating.
+#define SEGMENT_TIME_US               2000
+
+// Time the step pins are held high, and held low again before the next step, for the stepper drivers to see the pulse.
+// The A4988 needs 1us each, the DRV8825 1.9us. The step interrupt busy waits for it.
+#define STEPPER_PULSE_US              2
+
+// Shortest timer interval the step interrupt can keep up with, without the step pulses. At higher step rates, multiple
+// step events are done in a single interrupt, up to STEPPER_MAX_STEPS_PER_INTERRUPT.
+#define STEPPER_MIN_INTERVAL_US       20
+#define STEPPER_MAX_STEPS_PER_INTERRUPT 4
+// The highest step rate the step interrupt can sustain, with the high and low time of every step pulse on top of the
+// interrupt itself. The planner limits the nominal rate of blocks to this.
+// Step interrupt intervals are timed start to start, so the time spent in the interrupt is part of the interval and
+// not added to it. The arch timer has to keep this, the planner, the segment preparation and the sim all rely on it.
+#define STEPPER_MAX_STEP_RATE         (STEPPER_MAX_STEPS_PER_INTERRUPT * 1000000 / (STEPPER_MIN_INTERVAL_US + STEPPER_MAX_STEPS_PER_INTERRUPT * 2 * STEPPER_PULSE_US))
+
+// At low step rates, the step interrupt runs up to 2^MAX_OVERSAMPLING_LEVEL times per step event, so the steps
+// of the other axes are placed more accurately in time. It never runs more often than every OVERSAMPLING_MIN_INTERVAL_US.
+#define MAX_OVERSAMPLING_LEVEL        3
+#define OVERSAMPLING_MIN_INTERVAL_US  100
+
+// Define this to ramp the step rate along an S-curve instead of the straight ramps of the trapezoid. The rate follows
+// a smoothstep (3t^2 - 2t^3) over the same time as the trapezoid ramp, so blocks take as long and cover the same steps,
+// but the acceleration builds up from and back down to zero. The peak acceleration is 1.5 times the planner acceleration.
+//#define S_CURVE_ACCELERATION
@@ -1,44 +1,246 @@
 #include "fonts.h"
 #include "fonts.inc"
 #include <cstring>
+#include <math.h>
 
 const Font* current_font = nullptr;
 
 
+// 32 bit FNV-1a, the same hash convert.py uses to build _font_table.
+static uint32_t font_name_hash(const char* name)
+{
+    uint32_t hash = 2166136261u;
+    while(*name)
+        hash = (hash ^ uint8_t(*name++)) * 16777619u;
+    return hash;
+}
+
 bool font_set(const char* name)
 {
-    auto f = _all_fonts;
-    while(*f) {
-        if (strcmp((*f)->name, name) == 0) {
-            current_font = *f;
+    if (!name) {
+        current_font = nullptr;
+        return true;
+    }
+    for(auto slot = font_name_hash(name); ; slot++) {
+        auto f = _font_table[slot & (_font_table_size - 1)];
+        if (!f)
+            return false;
+        if (strcmp(f->name, name) == 0) {
+            current_font = f;
             return true;
         }
-        f++;
     }
-    return false;
 }
 
-static const Glyph* font_get_glyph(int codepoint)
+const char* font_get_current()
+{
+    return current_font ? current_font->name : nullptr;
+}
+
+const char* font_get_name(int index)
+{
+    for(auto f = _all_fonts; *f; f++, index--) {
+        if (index == 0)
+            return (*f)->name;
+    }
+    return nullptr;
+}
+
+static const Glyph* font_find_glyph(int codepoint)
 {
     if (!current_font) return nullptr;
-    for(auto glyph = current_font->glyphs; glyph->codepoint; glyph++) {
-        if (glyph->codepoint == codepoint) {
-            return glyph;
+    unsigned int offset = codepoint - current_font->first_codepoint;
+    if (offset >= current_font->codepoint_count) return nullptr;
+    auto index = current_font->glyph_index[offset];
+    if (index == _NO_GLYPH) return nullptr;
+    return &current_font->glyphs[index];
+}
+
+static uint32_t read_varint(const uint8_t*& data)
+{
+    uint32_t value = 0;
+    for(int shift=0; ; shift += 7) {
+        uint8_t b = *data++;
+        value |= uint32_t(b & 0x7F) << shift;
+        if (!(b & 0x80))
+            return value;
+    }
+}
+
+static int16_t unzigzag(uint32_t value)
+{
+    return (value & 1) ? -int16_t(value >> 1) - 1 : int16_t(value >> 1);
+}
+
+static int16_t read_signed(const uint8_t*& data)
+{
+    return unzigzag(read_varint(data));
+}
+
+// Element types, written by convert.py after the end point of curves.
+enum {
+    ELEMENT_LINE = 0,
+    ELEMENT_QUAD = 1,
+    ELEMENT_CUBIC = 2,
+    ELEMENT_ARC_CCW = 3,
+    ELEMENT_ARC_CW = 4,
+};
+
+// Upper limit on the lines a single curve is flattened into.
+static constexpr uint16_t max_curve_steps = 1024;
+
+static uint16_t clamp_steps(float steps)
+{
+    if (!(steps < max_curve_steps))
+        return max_curve_steps;
+    if (steps < 1)
+        return 1;
+    return uint16_t(ceilf(steps));
+}
+
+// Decode the next element of the stroke, and how many lines it is flattened into. The number of lines
+// of beziers follows Wang's formula, which bounds the distance between the curve and its lines by
+// the second differences of the control points. For arcs every line spans the angle at which the
+// chord stays within the tolerance of the circle.
+static void read_element(font_glyph_iterator_t& glyph)
+{
+    auto& p = glyph.p;
+    p[0][0] = glyph.x;
+    p[0][1] = glyph.y;
+    uint32_t header = read_varint(glyph.data);
+    glyph.x += unzigzag(header >> 1);
+    glyph.y += read_signed(glyph.data);
+    glyph.element = ELEMENT_LINE;
+    if (header & 1)
+        glyph.element = read_varint(glyph.data);
+    glyph.step = 0;
+    glyph.steps = 1;
+    switch(glyph.element) {
+    case ELEMENT_QUAD:
+        p[1][0] = p[0][0] + read_signed(glyph.data);
+        p[1][1] = p[0][1] + read_signed(glyph.data);
+        p[2][0] = glyph.x;
+        p[2][1] = glyph.y;
+        if (glyph.tolerance > 0)
+            glyph.steps = clamp_steps(sqrtf(hypotf(p[0][0] - 2 * p[1][0] + p[2][0], p[0][1] - 2 * p[1][1] + p[2][1]) / (4 * glyph.tolerance)));
+        else
+            glyph.steps = max_curve_steps;
+        break;
+    case ELEMENT_CUBIC: {
+        for(int n=1; n<3; n++) {
+            p[n][0] = p[0][0] + read_signed(glyph.data);
+            p[n][1] = p[0][1] + read_signed(glyph.data);
         }
+        p[3][0] = glyph.x;
+        p[3][1] = glyph.y;
+        float d1 = hypotf(p[0][0] - 2 * p[1][0] + p[2][0], p[0][1] - 2 * p[1][1] + p[2][1]);
+        float d2 = hypotf(p[1][0] - 2 * p[2][0] + p[3][0], p[1][1] - 2 * p[2][1] + p[3][1]);
+        if (glyph.tolerance > 0)
+            glyph.steps = clamp_steps(sqrtf(3 * fmaxf(d1, d2) / (4 * glyph.tolerance)));
+        else
+            glyph.steps = max_curve_steps;
+        } break;
+    case ELEMENT_ARC_CCW:
+    case ELEMENT_ARC_CW: {
+        float cx = p[0][0] + read_signed(glyph.data);
+        float cy = p[0][1] + read_signed(glyph.data);
+        float start_radius = hypotf(p[0][0] - cx, p[0][1] - cy);
+        float end_radius = hypotf(glyph.x - cx, glyph.y - cy);
+        float start_angle = atan2f(p[0][1] - cy, p[0][0] - cx);
+        float sweep = atan2f(glyph.y - cy, glyph.x - cx) - start_angle;
+        // A full turn when the arc ends where it starts.
+        if (glyph.element == ELEMENT_ARC_CCW && sweep <= 0)
+            sweep += 2 * float(M_PI);
+        else if (glyph.element == ELEMENT_ARC_CW && sweep >= 0)
+            sweep -= 2 * float(M_PI);
+        p[0][0] = cx;
+        p[0][1] = cy;
+        p[1][0] = start_angle;
+        p[1][1] = sweep;
+        p[2][0] = start_radius;
+        p[2][1] = end_radius;
+        float radius = fmaxf(start_radius, end_radius);
+        if (glyph.tolerance <= 0)
+            glyph.steps = max_curve_steps;
+        else if (glyph.tolerance < radius)
+            glyph.steps = clamp_steps(fabsf(sweep) / (2 * acosf(1 - glyph.tolerance / radius)));
+        } break;
     }
-    return nullptr;
 }
 
-const int16_t* font_get_lines(int codepoint)
+bool font_get_glyph(int codepoint, font_glyph_iterator_t& glyph, float tolerance)
 {
-    auto g = font_get_glyph(codepoint);
-    if (g) return g->lines;
-    return nullptr;
+    auto g = font_find_glyph(codepoint);
+    if (!g) return false;
+    glyph.data = current_font->data + g->offset;
+    glyph.elements_left = 0;
+    glyph.x = 0;
+    glyph.y = 0;
+    glyph.tolerance = tolerance;
+    glyph.step = 0;
+    glyph.steps = 0;
+    return true;
+}
+
+bool font_next_stroke(font_glyph_iterator_t& glyph)
+{
+    float x, y;
+    while(font_next_point(glyph, x, y)) {}
+    uint16_t count = read_varint(glyph.data);
+    if (count == 0) {
+        // Stay on the end marker, so further calls keep returning false.
+        glyph.data--;
+        return false;
+    }
+    // The start point is returned as a line of a single point.
+    glyph.x += read_signed(glyph.data);
+    glyph.y += read_signed(glyph.data);
+    glyph.elements_left = count - 1;
+    glyph.element = ELEMENT_LINE;
+    glyph.step = 0;
+    glyph.steps = 1;
+    return true;
+}
+
+bool font_next_point(font_glyph_iterator_t& glyph, float& x, float& y)
+{
+    if (glyph.step == glyph.steps) {
+        if (glyph.elements_left == 0) return false;
+        glyph.elements_left--;
+        read_element(glyph);
+    }
+    glyph.step++;
+    // The last point of an element is its exact end point, so rounding never accumulates.
+    if (glyph.step == glyph.steps) {
+        x = glyph.x;
+        y = glyph.y;
+        return true;
+    }
+    const auto& p = glyph.p;
+    float t = float(glyph.step) / float(glyph.steps);
+    float u = 1 - t;
+    switch(glyph.element) {
+    case ELEMENT_QUAD:
+        x = u * u * p[0][0] + 2 * u * t * p[1][0] + t * t * p[2][0];
+        y = u * u * p[0][1] + 2 * u * t * p[1][1] + t * t * p[2][1];
+        break;
+    case ELEMENT_CUBIC:
+        x = u * u * u * p[0][0] + 3 * u * u * t * p[1][0] + 3 * u * t * t * p[2][0] + t * t * t * p[3][0];
+        y = u * u * u * p[0][1] + 3 * u * u * t * p[1][1] + 3 * u * t * t * p[2][1] + t * t * t * p[3][1];
+        break;
+    default: {
+        float angle = p[1][0] + p[1][1] * t;
+        float radius = p[2][0] + (p[2][1] - p[2][0]) * t;
+        x = p[0][0] + radius * cosf(angle);
+        y = p[0][1] + radius * sinf(angle);
+        } break;
+    }
+    return true;
 }
 
 int16_t font_get_advance(int codepoint)
 {
-    auto g = font_get_glyph(codepoint);
+    auto g = font_find_glyph(codepoint);
     if (g) return g->advance;
     return 400;
 }
@@ -2,8 +2,34 @@
 
 #include <stdint.h>
 
-static constexpr uint16_t font_end_of_line = 0x7FFF;
+// Walks the strokes of a glyph and the points of each stroke straight from the packed font data,
+// without allocating. Curves are flattened into points while iterating. Usage:
+//   font_glyph_iterator_t glyph;
+//   if (font_get_glyph(c, glyph, tolerance))
+//       while(font_next_stroke(glyph))
+//           while(font_next_point(glyph, x, y))
+//               ...
+typedef struct {
+    const uint8_t* data;         // Next byte to decode
+    uint16_t elements_left;      // Elements not read yet in the current stroke
+    int16_t x, y;                // End point of the last decoded element
+    float tolerance;             // Maximum distance between a curve and its flattened lines, in font units
+    uint8_t element;             // Type of the element being flattened
+    uint16_t step, steps;        // Points of the current element returned so far, and in total
+    float p[4][2];               // Bezier: start, controls and end. Arc: center, {start angle, sweep}, {start radius, end radius}
+} font_glyph_iterator_t;
 
+// Select the font used by the font_get_* functions, nullptr selects no font. Returns false for an unknown name.
 bool font_set(const char* name);
-const int16_t* font_get_lines(int codepoint);
-int16_t font_get_advance(int codepoint);
\ No newline at end of file
+// Name of the current font, or nullptr when none is set.
+const char* font_get_current();
+// Name of the font at index, or nullptr past the last font.
+const char* font_get_name(int index);
+// Start iterating the glyph of codepoint in the current font, flattening curves to within tolerance font units.
+// Returns false when there is no such glyph.
+bool font_get_glyph(int codepoint, font_glyph_iterator_t& glyph, float tolerance);
+// Move to the next stroke, skipping the unread points of the current one. Returns false after the last stroke.
+bool font_next_stroke(font_glyph_iterator_t& glyph);
+// Read the next point of the current stroke. Returns false after the last point.
+bool font_next_point(font_glyph_iterator_t& glyph, float& x, float& y);
+int16_t font_get_advance(int codepoint);
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stdint.h>
+#include <type_traits>
+
+// Signed fixed point number with 16 fractional bits, stored in 64 bits.
+// Used as planner_real_t when PLANNER_FIXED_POINT is defined, so the planner can run without (soft)float math.
+//
+// The range is large enough for all planner values as long as intermediate products stay below 2^31
+// (speeds squared, 2*acceleration*distance, step counts times feedrate). The resolution is 1/65536.
+//
+// Compared to the float planner, the fixed point planner gives (measured over 30 runs of 40000 random moves,
+// tests/plannerFixedPoint.cpp checks these):
+//  * nominal_rate and acceleration_st within 0.2% or 1 step/sec, whichever is larger. Millimeters have a
+//    resolution of 1/65536, which limits the precision on moves of 1 or 2 step events to 1%.
+//  * initial_rate and final_rate within 0.2% or 5 steps/sec, whichever is larger, on all but 1 in 10000 blocks.
+//    Junction speeds follow from the blocks around them, the rare outliers are within 2% or 20 steps/sec.
+//  * accelerate_until and decelerate_after within 2 step events.
+struct fixed_t
+{
+    static constexpr int fraction_bits = 16;
+    static constexpr int64_t one = int64_t(1) << fraction_bits;
+
+    int64_t raw;
+
+    fixed_t() = default;
+    template<typename T, typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+    constexpr fixed_t(T value) : raw(int64_t(value) * one) {}
+    template<typename T, typename std::enable_if<std::is_floating_point<T>::value, int>::type = 0>
+    constexpr fixed_t(T value) : raw(int64_t(value * one + (value < 0 ? -0.5 : 0.5))) {}
+
+    static constexpr fixed_t from_raw(int64_t raw) { return fixed_t(raw, raw_tag()); }
+    // Exact integer ratio num/den, rounded towards zero.
+    static constexpr fixed_t from_ratio(int64_t num, int64_t den) { return from_raw((num * one) / den); }
+
+    constexpr fixed_t operator-() const { return from_raw(-raw); }
+    fixed_t& operator+=(fixed_t f) { raw += f.raw; return *this; }
+    fixed_t& operator-=(fixed_t f) { raw -= f.raw; return *this; }
+    fixed_t& operator*=(fixed_t f) { raw = (raw * f.raw) >> fraction_bits; return *this; }
+    fixed_t& operator/=(fixed_t f) { raw = (raw * one) / f.raw; return *this; }
+
+    friend constexpr fixed_t operator+(fixed_t a, fixed_t b) { return from_raw(a.raw + b.raw); }
+    friend constexpr fixed_t operator-(fixed_t a, fixed_t b) { return from_raw(a.raw - b.raw); }
+    friend constexpr fixed_t operator*(fixed_t a, fixed_t b) { return from_raw((a.raw * b.raw) >> fraction_bits); }
+    friend constexpr fixed_t operator/(fixed_t a, fixed_t b) { return from_raw((a.raw * one) / b.raw); }
+
+    friend constexpr bool operator==(fixed_t a, fixed_t b) { return a.raw == b.raw; }
+    friend constexpr bool operator!=(fixed_t a, fixed_t b) { return a.raw != b.raw; }
+    friend constexpr bool operator<(fixed_t a, fixed_t b) { return a.raw < b.raw; }
+    friend constexpr bool operator>(fixed_t a, fixed_t b) { return a.raw > b.raw; }
+    friend constexpr bool operator<=(fixed_t a, fixed_t b) { return a.raw <= b.raw; }
+    friend constexpr bool operator>=(fixed_t a, fixed_t b) { return a.raw >= b.raw; }
+
+private:
+    struct raw_tag {};
+    constexpr fixed_t(int64_t raw_value, raw_tag) : raw(raw_value) {}
+};
+
+// Math functions matching the <math.h> ones used by the planner. ceil/floor/trunc return integers,
+// as the planner only uses them to get step counts and rates.
+static inline fixed_t fabs(fixed_t f)
+{
+    return f.raw < 0 ? -f : f;
+}
+
+static inline int64_t ceil(fixed_t f)
+{
+    return (f.raw + fixed_t::one - 1) >> fixed_t::fraction_bits;
+}
+
+static inline int64_t floor(fixed_t f)
+{
+    return f.raw >> fixed_t::fraction_bits;
+}
+
+static inline int64_t trunc(fixed_t f)
+{
+    return f.raw / fixed_t::one;
+}
+
+// Integer square root, bit by bit.
+static inline uint64_t fixed_isqrt(uint64_t value)
+{
+    uint64_t result = 0;
+    uint64_t bit = uint64_t(1) << 62;
+    while (bit > value)
+        bit >>= 2;
+    while (bit) {
+        if (value >= result + bit) {
+            value -= result + bit;
+            result = (result >> 1) + bit;
+        } else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+    return result;
+}
+
+// Negative inputs give 0 instead of NaN.
+static inline fixed_t sqrt(fixed_t f)
+{
+    if (f.raw <= 0)
+        return 0;
+    return fixed_t::from_raw(fixed_isqrt(uint64_t(f.raw) << fixed_t::fraction_bits));
+}
+
+// Length of the vector (a, b). The squares are kept at double precision, as squaring small
+// values (sub millimeter moves) would otherwise lose all significant bits.
+static inline fixed_t hypot(fixed_t a, fixed_t b)
+{
+    return fixed_t::from_raw(fixed_isqrt(uint64_t(a.raw * a.raw) + uint64_t(b.raw * b.raw)));
+}
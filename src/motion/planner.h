@@ -21,27 +21,58 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <atomic>
 
 #include "../config/planner.h"
+#include "../config/stepper.h"
+
+#ifdef PLANNER_FIXED_POINT
+#include "fixedPoint.h"
+typedef fixed_t planner_real_t;
+#else
+typedef float planner_real_t;
+#endif
 
 #define BLOCK_BUFFER_SIZE 32
 
+// Blocks are either a linear movement, or a command executed by the stepper in order with the movements.
+// Commands are full stops: the movement before a command ends at standstill.
+typedef enum : uint8_t {
+    BLOCK_MOTION,
+    BLOCK_PEN_UP,
+    BLOCK_PEN_DOWN,
+    BLOCK_DWELL,
+} block_type_t;
+
+// Handoff of a block between the planner and the stepper, which can run on different cores. The planner only
+// writes a block it holds in BLOCK_STATE_PLANNING. The stepper takes a block by moving it from BLOCK_STATE_QUEUED
+// to BLOCK_STATE_BUSY, after which the planner no longer changes it. The stepper takes blocks in order, so while
+// the planner holds the oldest block it can change, the stepper stays away from all blocks after it as well.
+typedef enum : uint8_t {
+    BLOCK_STATE_QUEUED,                      // Planned, the stepper may take it
+    BLOCK_STATE_PLANNING,                    // Being updated by the planner
+    BLOCK_STATE_BUSY,                        // Taken by the stepper, or a free entry of the ring buffer
+} block_state_t;
+
 // This struct is used when buffering the setup for each linear movement "nominal" values are as specified in
 // the source g-code and may never actually be reached if acceleration management is active.
-typedef struct {
+template<int AXES> struct PlannerBlock {
+    block_type_t type;
+    unsigned int dwell_us;                   // Duration of a BLOCK_DWELL
+
     // Fields used by the bresenham algorithm for tracing the line
-    unsigned int steps[OUTPUT_AXIS_COUNT];   // Step count along each axis
+    unsigned int steps[AXES];                // Step count along each axis
     unsigned int step_event_count;           // The number of step events required to complete this block
     unsigned int accelerate_until;           // The index of the step event on which to stop acceleration
     unsigned int decelerate_after;           // The index of the step event on which to start decelerating
     unsigned char direction_bits;             // The direction bit set for this block
 
     // Fields used by the motion planner to manage acceleration
-    float nominal_speed;                               // The nominal speed for this block in mm/sec
-    float entry_speed;                                 // Entry speed at previous-current junction in mm/sec
-    float max_entry_speed;                             // Maximum allowable junction entry speed in mm/sec
-    float millimeters;                                 // The total travel of this block in mm
-    float acceleration;                                // acceleration mm/sec^2
+    planner_real_t nominal_speed;                      // The nominal speed for this block in mm/sec
+    planner_real_t entry_speed;                        // Entry speed at previous-current junction in mm/sec
+    planner_real_t max_entry_speed;                    // Maximum allowable junction entry speed in mm/sec
+    planner_real_t millimeters;                        // The total travel of this block in mm
+    planner_real_t acceleration;                       // acceleration mm/sec^2
     bool recalculate_flag;                             // Planner flag to recalculate trapezoids on entry junction
     bool nominal_length_flag;                          // Planner flag for nominal speed always reached
 
@@ -50,8 +81,142 @@ typedef struct {
     unsigned int initial_rate;                        // The jerk-adjusted step rate at start of block
     unsigned int final_rate;                          // The minimal rate at exit
     unsigned int acceleration_st;                     // acceleration steps/sec^2
-    volatile bool busy;
-} block_t;
+#ifdef S_CURVE_ACCELERATION
+    unsigned int peak_rate;                           // The step rate reached at accelerate_until
+    unsigned int acceleration_us;                     // Duration of the acceleration, the same as the trapezoid ramp
+    unsigned int deceleration_us;                     // Duration of the deceleration
+#endif
+    std::atomic<block_state_t> state;
+};
+
+typedef PlannerBlock<OUTPUT_AXIS_COUNT> block_t;
+
+// A motion planner with its own block buffer, position and settings. The planner_* functions below use a default
+// instance, more instances simulate more machines side by side, see Stepper and SimMotors.
+// planner.cpp instantiates the configured axis count and BLOCK_BUFFER_SIZE, add an instantiation there for other sizes.
+// Positions have INPUT_AXIS_COUNT axes in mm, the kinematics function maps them to the steps of the AXES motors.
+template<int AXES, int BUFFER_SIZE> class Planner
+{
+    static_assert((BUFFER_SIZE & (BUFFER_SIZE - 1)) == 0 && BUFFER_SIZE <= 128, "BUFFER_SIZE must be a power of 2 up to 128");
+    static_assert(AXES <= 8, "direction_bits has a bit per axis");
+public:
+    typedef PlannerBlock<AXES> Block;
+    typedef void (*Kinematics)(const float (&position)[INPUT_AXIS_COUNT], const float (&axis_steps_per_unit)[AXES], long (&step_position)[AXES]);
+
+    // Input axis n drives motor n.
+    static void direct_kinematics(const float (&position)[INPUT_AXIS_COUNT], const float (&units_to_steps)[AXES], long (&step_position)[AXES]);
+
+    Planner(Kinematics kinematics = direct_kinematics);
+
+    // Clear the buffer and the position, and apply the settings below.
+    void init();
+
+    // Add a new linear movement to the buffer. position is the signed, absolute target position in
+    // millimeters. Feed rate specifies the speed of the motion.
+    bool buffer_line(const float (&position)[INPUT_AXIS_COUNT], float feed_rate, float acceleration);
+
+    // Queue a pen change or a dwell after the buffered movements. Returns false when the buffer is full.
+    bool buffer_pen(bool down);
+    bool buffer_dwell(unsigned int dwell_us);
+
+    // Queue a block that was planned before, such as a block of a compiled job, without planning it again. Only the
+    // fields the stepper uses are taken, their rates have to join up with the blocks around it. The plan so far ends
+    // with this block, a following buffer_line() starts from a stop. Returns false when the buffer is full.
+    bool buffer_planned(const Block& planned);
+
+    // Set position. Used for G92 instructions.
+    void set_position(const float (&position)[INPUT_AXIS_COUNT]);
+
+    uint8_t buf_free_positions();  // return the number of free positions in the planner buffer.
+
+    // Apply changed acceleration or steps per unit settings.
+    void reset_acceleration_rates();
+
+    // Execution time of a block in microseconds: the trapezoid of a move, the dwell time of a dwell, and the settle
+    // time of a pen change. The stepper starts a pen change up to its lead time before the end of the move before it,
+    // previous_move_us is the time of that move, 0 if the block before it is no move.
+    static unsigned int block_time_us(const Block* block, unsigned int previous_move_us);
+    // Execution time of all queued blocks, including the one the stepper is busy with. The trapezoids of queued blocks
+    // change while blocks are added, so this has to be called from the thread that adds them, never from another core.
+    uint64_t queued_time_us();
+
+    // Called when the current block is no longer needed. Discards the block and makes the memory
+    // available for new blocks.
+    void discard_current_block()
+    {
+        uint8_t tail = block_buffer_tail.load(std::memory_order_relaxed);
+        if (block_buffer_head.load(std::memory_order_acquire) != tail)
+            block_buffer_tail.store((tail + 1) & (BUFFER_SIZE - 1), std::memory_order_release);
+    }
+
+    // Gets the current block and marks it busy, so the planner no longer changes it. Returns NULL if the buffer
+    // is empty, or while the planner is updating the block.
+    Block *get_current_block()
+    {
+        uint8_t tail = block_buffer_tail.load(std::memory_order_relaxed);
+        if (block_buffer_head.load(std::memory_order_acquire) == tail)
+            return NULL;
+        Block *block = &block_buffer[tail];
+        block_state_t state = BLOCK_STATE_QUEUED;
+        if (!block->state.compare_exchange_strong(state, BLOCK_STATE_BUSY, std::memory_order_acquire) && state != BLOCK_STATE_BUSY)
+            return NULL;
+        return block;
+    }
+
+    // Gets the block after the current block, without marking it busy. Only its type is final. Returns NULL if there is none.
+    Block *get_next_block()
+    {
+        uint8_t tail = block_buffer_tail.load(std::memory_order_relaxed);
+        uint8_t head = block_buffer_head.load(std::memory_order_acquire);
+        uint8_t next = (tail + 1) & (BUFFER_SIZE - 1);
+        if (head == tail || next == head)
+            return NULL;
+        return &block_buffer[next];
+    }
+
+    // Returns true when blocks are queued, false otherwise.
+    bool blocks_queued()
+    {
+        return block_buffer_head.load(std::memory_order_acquire) != block_buffer_tail.load(std::memory_order_acquire);
+    }
+
+    // Settings, applied by init() and reset_acceleration_rates(). Axes past the configured defaults start at 0.
+    float max_feedrate[AXES] = DEFAULT_MAX_FEEDRATE; // set the max speeds
+    unsigned long max_acceleration_units_per_sq_second[AXES] = DEFAULT_MAX_ACCELERATION; // Use M201 to override by software
+    float axis_steps_per_unit[AXES] = DEFAULT_AXIS_STEPS_PER_UNIT;
+    float minimumfeedrate = 0;
+    float max_xy_jerk = DEFAULT_XYJERK; //speed that can be stopped at once, if I understand correctly.
+    float max_z_jerk = DEFAULT_ZJERK;
+    unsigned long axis_steps_per_sqr_second[AXES];
+
+    // The block ring buffer is a single producer, single consumer queue. Only the planner moves the head, only the
+    // stepper moves the tail. A new head is published with release ordering, after the block is written.
+    Block block_buffer[BUFFER_SIZE];                    // A ring buffer for motion instructions
+    std::atomic<uint8_t> block_buffer_head;             // Index of the next block to be pushed
+    std::atomic<uint8_t> block_buffer_tail;             // Index of the block being executed
+
+private:
+    static uint8_t next_block_index(uint8_t block_index) { return (block_index + 1) & (BUFFER_SIZE - 1); }
+    static uint8_t prev_block_index(uint8_t block_index) { return (block_index - 1) & (BUFFER_SIZE - 1); }
+    uint8_t moves_planned();
+    bool buffer_command(block_type_t type, unsigned int dwell_us);
+    bool hold_block(uint8_t block_index);
+    void forward_pass_kernel(Block *previous, Block *current, uint8_t current_index);
+    void reverse_pass();
+    void forward_pass();
+    void recalculate_trapezoids(uint8_t first_index);
+    void recalculate();
+
+    Kinematics position_to_steps;
+    uint8_t block_buffer_planned;                       // Index of the last block whose entry speed is final, blocks after it can still be replanned
+    long final_step_position[AXES];                     // The current position of the tool in absolute steps
+    planner_real_t previous_speed[AXES];                // Speed of previous path line segment
+    planner_real_t previous_nominal_speed;              // Nominal speed of previous path line segment
+    planner_real_t previous_unit_vector[AXES];          // Direction of previous path line segment
+    planner_real_t steps_per_unit[AXES];                // Copy of axis_steps_per_unit, set by reset_acceleration_rates()
+};
+
+extern Planner<OUTPUT_AXIS_COUNT, BLOCK_BUFFER_SIZE> default_planner;
 
 // Initialize the motion plan subsystem
 void planner_init();
@@ -60,50 +225,56 @@ void planner_init();
 // millimeters. Feed rate specifies the speed of the motion.
 bool planner_buffer_line(const float (&position)[INPUT_AXIS_COUNT], float feed_rate, float acceleration);
 
+// Queue a pen change or a dwell after the buffered movements. Returns false when the buffer is full.
+bool planner_buffer_pen(bool down);
+bool planner_buffer_dwell(unsigned int dwell_us);
+
 // Set position. Used for G92 instructions.
 void planner_set_position(const float (&position)[INPUT_AXIS_COUNT]);
 
 uint8_t planner_buf_free_positions();  // return the number of free positions in the planner buffer.
 
-extern float max_feedrate[OUTPUT_AXIS_COUNT]; // set the max speeds
-
-extern unsigned long max_acceleration_units_per_sq_second[OUTPUT_AXIS_COUNT]; // Use M201 to override by software
-extern float minimumfeedrate;
-extern float max_xy_jerk;          //speed that can be stopped at once, if I understand correctly.
-extern float max_z_jerk;
-extern unsigned long axis_steps_per_sqr_second[OUTPUT_AXIS_COUNT];
-
-
+// The settings and ring buffer of the default planner.
+extern float (&max_feedrate)[OUTPUT_AXIS_COUNT]; // set the max speeds
+extern unsigned long (&max_acceleration_units_per_sq_second)[OUTPUT_AXIS_COUNT]; // Use M201 to override by software
+extern float (&axis_steps_per_unit)[OUTPUT_AXIS_COUNT];
+extern float& minimumfeedrate;
+extern float& max_xy_jerk;          //speed that can be stopped at once, if I understand correctly.
+extern float& max_z_jerk;
+extern unsigned long (&axis_steps_per_sqr_second)[OUTPUT_AXIS_COUNT];
 
+extern block_t (&block_buffer)[BLOCK_BUFFER_SIZE];       // A ring buffer for motion instructions
+extern std::atomic<uint8_t>& block_buffer_head;          // Index of the next block to be pushed
+extern std::atomic<uint8_t>& block_buffer_tail;          // Index of the block being executed
 
-extern block_t block_buffer[BLOCK_BUFFER_SIZE];            // A ring buffer for motion instructions
-extern volatile unsigned char block_buffer_head;           // Index of the next block to be pushed
-extern volatile unsigned char block_buffer_tail;
 // Called when the current block is no longer needed. Discards the block and makes the memory
 // available for new blocks.
 static inline void planner_discard_current_block()
 {
-    if (block_buffer_head != block_buffer_tail)
-        block_buffer_tail = (block_buffer_tail + 1) & (BLOCK_BUFFER_SIZE - 1);
+    default_planner.discard_current_block();
 }
 
-// Gets the current block. Returns NULL if buffer empty
+// Gets the current block and marks it busy, so the planner no longer changes it. Returns NULL if the buffer
+// is empty, or while the planner is updating the block.
 static inline block_t *planner_get_current_block()
 {
-    if (block_buffer_head == block_buffer_tail)
-        return NULL;
-    block_t *block = &block_buffer[block_buffer_tail];
-    block->busy = true;
-    return block;
+    return default_planner.get_current_block();
+}
+
+// Gets the block after the current block, without marking it busy. Only its type is final. Returns NULL if there is none.
+static inline block_t *planner_get_next_block()
+{
+    return default_planner.get_next_block();
 }
 
 // Returns true when blocks are queued, false otherwise.
 static inline bool blocks_queued()
 {
-    if (block_buffer_head == block_buffer_tail)
-        return false;
-    else
-        return true;
+    return default_planner.blocks_queued();
 }
 
 void reset_acceleration_rates();
+
+// Execution time of all blocks queued in the default planner, in microseconds. Only call it from the thread that
+// buffers the moves, see Planner::queued_time_us().
+uint64_t planner_queued_time_us();
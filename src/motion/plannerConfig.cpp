@@ -2,9 +2,7 @@
 
 #include <math.h>
 
-float axis_steps_per_unit[OUTPUT_AXIS_COUNT] = DEFAULT_AXIS_STEPS_PER_UNIT;
-
-void planner_position_to_steps(const float (&position)[INPUT_AXIS_COUNT], long (&step_position)[OUTPUT_AXIS_COUNT])
+void planner_position_to_steps(const float (&position)[INPUT_AXIS_COUNT], const float (&axis_steps_per_unit)[OUTPUT_AXIS_COUNT], long (&step_position)[OUTPUT_AXIS_COUNT])
 {
     step_position[0] = lround(position[0]*axis_steps_per_unit[0]);
     step_position[1] = lround(position[1]*axis_steps_per_unit[1]);
@@ -2,6 +2,5 @@
 
 #include "../config/planner.h"
 
-extern float axis_steps_per_unit[OUTPUT_AXIS_COUNT];
-
-void planner_position_to_steps(const float (&position)[INPUT_AXIS_COUNT], long (&step_position)[OUTPUT_AXIS_COUNT]);
+// The kinematics of the machine: map a position of the input axes in mm to the absolute step position of each motor.
+void planner_position_to_steps(const float (&position)[INPUT_AXIS_COUNT], const float (&axis_steps_per_unit)[OUTPUT_AXIS_COUNT], long (&step_position)[OUTPUT_AXIS_COUNT]);
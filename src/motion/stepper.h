@@ -1,3 +1,411 @@
 #pragma once
 
-void stepper_init();
\ No newline at end of file
+#include "planner.h"
+#include "fixedPoint.h"
+#include "config/stepper.h"
+#include "config/pen.h"
+#include <algorithm>
+#include <atomic>
+
+void stepper_init();
+
+// Slice planned blocks into step segments for the step interrupt. Needs to be called regularly from
+// the main loop while moves are queued, the step interrupt itself does no rate calculations.
+void stepper_prepare_segments();
+
+// Returns true when no block is being prepared and all prepared segments are executed.
+bool stepper_is_idle();
+
+// Estimated time in microseconds until all queued blocks are executed, from the prepared segments and the
+// trapezoids of the planned blocks. Call it from the main loop that buffers the moves and prepares the segments,
+// the planned blocks and the segment preparation state are not safe to read from another core.
+uint64_t stepper_remaining_time_us();
+// Time in microseconds of the segments executed since the start. With the remaining time this gives the progress.
+uint64_t stepper_elapsed_time_us();
+
+// Executes the blocks of a Planner on a set of motors, with a buffer of SEGMENTS step segments. The stepper_*
+// functions above use a default instance, on the default planner and the arch motors. Motors provides:
+//   void attach(void (*interrupt_function)(void*), void* context);   Call interrupt_function(context) on the step timer
+//   void set_interval(unsigned int interval_us);
+//   void set_direction(int index, bool active);
+//   void set_step_pulse(int index, bool active);
+//   void pulse_wait();                                               Wait STEPPER_PULSE_US
+//   void pen_up();
+//   void pen_down();
+template<int AXES, int BLOCKS, int SEGMENTS, typename Motors> class Stepper
+{
+    static_assert((SEGMENTS & (SEGMENTS - 1)) == 0 && SEGMENTS <= 128, "SEGMENTS must be a power of 2 up to 128");
+    static_assert(STEPPER_MIN_INTERVAL_US >= STEPPER_PULSE_US, "the step pins stay low between interrupts for at least STEPPER_PULSE_US");
+public:
+    typedef PlannerBlock<AXES> Block;
+
+    Stepper(Planner<AXES, BLOCKS>& block_planner, Motors& step_motors)
+    : planner(block_planner), motors(step_motors)
+    {
+    }
+
+    void init()
+    {
+        motors.attach(interrupt_trampoline, this);
+        motors.set_interval(1000);
+    }
+
+    // The step interrupt.
+    void interrupt()
+    {
+        if (!current_segment) {
+            uint8_t tail = segment_buffer_tail.load(std::memory_order_relaxed);
+            if (segment_buffer_head.load(std::memory_order_acquire) == tail) {
+                motors.set_interval(1000);
+                return;
+            }
+            current_segment = &segment_buffer[tail];
+            motors.set_interval(current_segment->interval_us);
+            if (current_block != &stepper_block_buffer[current_segment->block_index]) {
+                current_block = &stepper_block_buffer[current_segment->block_index];
+                for(int n=0; n<AXES; n++) {
+                    counters[n] = -int(current_block->step_event_count / 2);
+                    motors.set_direction(n, (current_block->direction_bits & (1 << n)));
+                }
+            }
+            for(int n=0; n<AXES; n++)
+                current_steps[n] = current_block->steps[n] >> current_segment->oversampling_level;
+            if (current_segment->command == BLOCK_PEN_UP)
+                motors.pen_up();
+            else if (current_segment->command == BLOCK_PEN_DOWN)
+                motors.pen_down();
+        }
+
+        // The pins go low again after STEPPER_PULSE_US, and stay low at least as long before the next step.
+        for(uint8_t step=0; step<current_segment->steps_per_tick; step++) {
+            bool stepped = false;
+            for(int n=0; n<AXES; n++) {
+                counters[n] += current_steps[n];
+                if (counters[n] > 0) {
+                    motors.set_step_pulse(n, true);
+                    counters[n] -= current_block->step_event_count;
+                    stepped = true;
+                }
+            }
+            if (!stepped)
+                continue;
+            motors.pulse_wait();
+            for(int n=0; n<AXES; n++) {
+                motors.set_step_pulse(n, false);
+            }
+            if (step + 1 < current_segment->steps_per_tick)
+                motors.pulse_wait();
+        }
+
+        if (--current_segment->ticks == 0) {
+            current_segment = nullptr;
+            segment_buffer_tail.store((segment_buffer_tail.load(std::memory_order_relaxed) + 1) & (SEGMENTS - 1), std::memory_order_release);
+        }
+    }
+
+    // See stepper_prepare_segments().
+    void prepare_segments()
+    {
+        while(true) {
+            uint8_t head = segment_buffer_head.load(std::memory_order_relaxed);
+            uint8_t next_head = (head + 1) & (SEGMENTS - 1);
+            if (next_head == segment_buffer_tail.load(std::memory_order_acquire))
+                return;
+
+            if (!prep_block) {
+                prep_block = planner.get_current_block();
+                if (!prep_block)
+                    return;
+                if (prep_block->type == BLOCK_MOTION)
+                    start_motion_block();
+            }
+
+            if (prep_block->type != BLOCK_MOTION) {
+                prepare_command();
+                continue;
+            }
+
+            // The rate after a step event depends on the phase of the trapezoid that step event is in.
+            // A segment runs at a single rate, so it never crosses into the next phase.
+            unsigned int step_event = step_events_completed + 1;
+            unsigned int rate;
+            unsigned int phase_end;
+            if (step_event < prep_block->accelerate_until) {
+#ifdef S_CURVE_ACCELERATION
+                // The S-curve bends away from its tangent at the start of a segment, so take the rate halfway a segment.
+                rate = prep_block->initial_rate;
+                if (prep_block->peak_rate > rate)
+                    rate += s_curve_rate(prep_block->peak_rate - rate, acceleration_time_us + SEGMENT_TIME_US / 2, prep_block->acceleration_us);
+#else
+                rate = (uint64_t(acceleration_time_us) * uint64_t(prep_block->acceleration_st)) / 1000000;
+                rate += prep_block->initial_rate;
+#endif
+                if (rate > prep_block->nominal_rate)
+                    rate = prep_block->nominal_rate;
+                acceleration_step_rate = rate;
+                phase_end = prep_block->accelerate_until - 1;
+            } else if (step_event > prep_block->decelerate_after) {
+#ifdef S_CURVE_ACCELERATION
+                rate = 0;
+                if (acceleration_step_rate > prep_block->final_rate)
+                    rate = s_curve_rate(acceleration_step_rate - prep_block->final_rate, deceleration_time_us + SEGMENT_TIME_US / 2, prep_block->deceleration_us);
+#else
+                rate = (uint64_t(deceleration_time_us) * uint64_t(prep_block->acceleration_st)) / 1000000;
+#endif
+                if (rate < acceleration_step_rate)
+                    rate = std::max(acceleration_step_rate - rate, prep_block->final_rate);
+                else
+                    rate = prep_block->final_rate;
+                phase_end = prep_block->step_event_count;
+            } else {
+                // Without a plateau the profile is a triangle, so keep the peak rate reached while accelerating.
+                if (prep_block->accelerate_until < prep_block->decelerate_after)
+                    acceleration_step_rate = prep_block->nominal_rate;
+                rate = acceleration_step_rate;
+                phase_end = std::min(prep_block->decelerate_after, prep_block->step_event_count);
+            }
+
+            segment_t* segment = &segment_buffer[head];
+            unsigned int interval_us = 1000000 / rate;
+            unsigned int step_events = std::max(SEGMENT_TIME_US / interval_us, 1u);
+            step_events = std::min(step_events, phase_end - step_events_completed);
+            segment->command = BLOCK_MOTION;
+            segment->steps_per_tick = 1;
+            segment->oversampling_level = 0;
+            if (interval_us < tick_min_interval_us(1)) {
+                // Too fast for an interrupt per step event, do multiple step events per interrupt. Only the interrupt
+                // itself is shared, every step event adds its pulse time.
+                unsigned int pulse_us = 2 * STEPPER_PULSE_US;
+                unsigned int steps_per_tick = STEPPER_MAX_STEPS_PER_INTERRUPT;
+                if (interval_us > pulse_us)
+                    steps_per_tick = std::min((STEPPER_MIN_INTERVAL_US + interval_us - pulse_us - 1) / (interval_us - pulse_us), steps_per_tick);
+                if (step_events < steps_per_tick)
+                    steps_per_tick = step_events;
+                else
+                    step_events -= step_events % steps_per_tick;
+                segment->steps_per_tick = steps_per_tick;
+                segment->ticks = step_events / steps_per_tick;
+                // A short remainder at the end of a phase can still be too fast, stretch it to the minimal interval.
+                segment->interval_us = std::max(1000000 * steps_per_tick / rate, tick_min_interval_us(steps_per_tick));
+            } else {
+                // Slow enough to oversample, so the other axes step closer to their exact time.
+                while(segment->oversampling_level < MAX_OVERSAMPLING_LEVEL && (interval_us >> segment->oversampling_level) >= 2 * OVERSAMPLING_MIN_INTERVAL_US)
+                    segment->oversampling_level++;
+                segment->ticks = step_events << segment->oversampling_level;
+                segment->interval_us = 1000000 / (rate << segment->oversampling_level);
+            }
+            segment->block_index = prep_block_index;
+            if (lead_command != BLOCK_MOTION && !lead_started && block_time_us >= lead_start_us) {
+                segment->command = lead_command;
+                lead_started = true;
+                lead_time_us = block_time_us;   // Start time for now, the time to the end once the block is done
+            }
+            segment->duration_us = segment->ticks * segment->interval_us;
+            prepared_time_us += segment->duration_us;
+            block_time_us += segment->duration_us;
+
+            step_events_completed += step_events;
+            if (step_event < prep_block->accelerate_until)
+                acceleration_time_us += segment->duration_us;
+            else if (step_event > prep_block->decelerate_after)
+                deceleration_time_us += segment->duration_us;
+
+            if (step_events_completed >= prep_block->step_event_count) {
+                // The estimate can be a little longer than the prepared segments, then the pen change is not started early.
+                if (lead_started)
+                    lead_time_us = block_time_us - lead_time_us;
+                else
+                    lead_command = BLOCK_MOTION;
+                prep_block = nullptr;
+                planner.discard_current_block();
+            }
+            segment_buffer_head.store(next_head, std::memory_order_release);
+        }
+    }
+
+    // See stepper_is_idle().
+    bool is_idle()
+    {
+        // The tail only moves after the executing segment is done.
+        return !prep_block && segment_buffer_head.load(std::memory_order_relaxed) == segment_buffer_tail.load(std::memory_order_acquire);
+    }
+
+    // See stepper_remaining_time_us(). The segment being executed counts in full.
+    uint64_t remaining_time_us()
+    {
+        uint64_t time_us = planner.queued_time_us();
+        // prep_block is the oldest queued block, the part of it in segments is counted with the segments.
+        if (prep_block) {
+            unsigned int prep_us = Planner<AXES, BLOCKS>::block_time_us(prep_block, 0);
+            time_us -= std::min(prep_us, block_time_us);
+        }
+        return time_us + queued_segments_time_us();
+    }
+
+    // See stepper_elapsed_time_us().
+    uint64_t elapsed_time_us()
+    {
+        return prepared_time_us - queued_segments_time_us();
+    }
+
+private:
+    // The part of a planner block needed by the step interrupt. Copied out of the planner block,
+    // so the planner block can be discarded as soon as all its segments are prepared.
+    // Step counts are multiplied by 2^MAX_OVERSAMPLING_LEVEL, so oversampled segments only need a shift.
+    typedef struct {
+        unsigned int steps[AXES];                // Step count along each axis
+        unsigned int step_event_count;           // The number of step events required to complete this block
+        unsigned char direction_bits;            // The direction bit set for this block
+    } stepper_block_t;
+
+    // A short part of a block, executed by the step interrupt at a single step rate.
+    // At high step rates, each interrupt does steps_per_tick step events. At low step rates,
+    // each step event takes 2^oversampling_level interrupts. Dwells and pen changes are segments without step events.
+    typedef struct {
+        unsigned int ticks;                      // Number of step interrupts in this segment
+        unsigned int interval_us;                // Timer interval after each step interrupt
+        uint8_t steps_per_tick;                  // Number of step events per step interrupt
+        uint8_t oversampling_level;              // Step interrupts per step event, as power of 2
+        uint8_t block_index;                     // Index in stepper_block_buffer of the block this segment belongs to
+        block_type_t command;                    // Pen change done at the start of this segment
+        unsigned int duration_us;                // ticks * interval_us, the interrupt does not change it
+    } segment_t;
+
+    static void interrupt_trampoline(void* context)
+    {
+        static_cast<Stepper*>(context)->interrupt();
+    }
+
+    // Shortest interval of an interrupt doing steps_per_tick step events, each with its high and low pulse time.
+    static constexpr unsigned int tick_min_interval_us(unsigned int steps_per_tick)
+    {
+        return STEPPER_MIN_INTERVAL_US + steps_per_tick * 2 * STEPPER_PULSE_US;
+    }
+
+#ifdef S_CURVE_ACCELERATION
+    // Rate change after time_us of an S-curve ramp of delta_rate over duration_us, delta_rate * smoothstep(time_us / duration_us).
+    // Fixed point with 16 fraction bits, so it is cheap without an FPU.
+    static unsigned int s_curve_rate(unsigned int delta_rate, unsigned int time_us, unsigned int duration_us)
+    {
+        if (time_us >= duration_us)
+            return delta_rate;
+        uint64_t t = (uint64_t(time_us) << 16) / duration_us;
+        uint64_t smoothstep = (t * t * ((uint64_t(3) << 16) - 2 * t)) >> 32;
+        return (uint64_t(delta_rate) * smoothstep) >> 16;
+    }
+#endif
+
+    // Copy the motion block in prep_block for the step interrupt and start preparing its segments.
+    void start_motion_block()
+    {
+        prep_block_index = (prep_block_index + 1) & (SEGMENTS - 1);
+        stepper_block_t* block = &stepper_block_buffer[prep_block_index];
+        for(int n=0; n<AXES; n++)
+            block->steps[n] = prep_block->steps[n] << MAX_OVERSAMPLING_LEVEL;
+        block->step_event_count = prep_block->step_event_count << MAX_OVERSAMPLING_LEVEL;
+        block->direction_bits = prep_block->direction_bits;
+        step_events_completed = 0;
+        acceleration_time_us = 0;
+        acceleration_step_rate = prep_block->initial_rate;
+        deceleration_time_us = 0;
+        block_time_us = 0;
+
+        lead_command = BLOCK_MOTION;
+        lead_started = false;
+        Block* next = planner.get_next_block();
+        if (next && (next->type == BLOCK_PEN_UP || next->type == BLOCK_PEN_DOWN)) {
+            unsigned int lead_us = next->type == BLOCK_PEN_UP ? PEN_UP_LEAD_US : PEN_DOWN_LEAD_US;
+            unsigned int duration_us = Planner<AXES, BLOCKS>::block_time_us(prep_block, 0);
+            if (lead_us > 0) {
+                lead_command = next->type;
+                lead_start_us = duration_us > lead_us ? duration_us - lead_us : 0;
+            }
+        }
+    }
+
+    // Queue a segment without step events that takes duration_us. A pen change is done at its start,
+    // so the segment is the time the pen needs to settle.
+    void prepare_wait_segment(block_type_t command, unsigned int duration_us)
+    {
+        uint8_t head = segment_buffer_head.load(std::memory_order_relaxed);
+        segment_t* segment = &segment_buffer[head];
+        segment->command = command;
+        segment->ticks = std::max((duration_us + SEGMENT_TIME_US - 1) / SEGMENT_TIME_US, 1u);
+        segment->interval_us = std::max(duration_us / segment->ticks, unsigned(STEPPER_MIN_INTERVAL_US));
+        segment->steps_per_tick = 0;
+        segment->oversampling_level = 0;
+        // Stay on the block of the previous segment, so the interrupt keeps its step state.
+        segment->block_index = prep_block_index;
+        segment->duration_us = segment->ticks * segment->interval_us;
+        prepared_time_us += segment->duration_us;
+        segment_buffer_head.store((head + 1) & (SEGMENTS - 1), std::memory_order_release);
+    }
+
+    // Turn the command block in prep_block into a wait segment, executed in order with the motion segments.
+    void prepare_command()
+    {
+        switch(prep_block->type) {
+        case BLOCK_PEN_UP:
+        case BLOCK_PEN_DOWN: {
+            unsigned int settle_us = prep_block->type == BLOCK_PEN_UP ? PEN_UP_SETTLE_TIME_US : PEN_DOWN_SETTLE_TIME_US;
+            if (lead_command != prep_block->type) {
+                prepare_wait_segment(prep_block->type, settle_us);
+            } else if (settle_us > lead_time_us) {
+                // Already started during the previous move, only wait for the rest of the settle time.
+                prepare_wait_segment(BLOCK_DWELL, settle_us - lead_time_us);
+            }
+            lead_command = BLOCK_MOTION;
+            } break;
+        case BLOCK_DWELL:
+            if (prep_block->dwell_us > 0)
+                prepare_wait_segment(BLOCK_DWELL, prep_block->dwell_us);
+            break;
+        case BLOCK_MOTION:
+            break;
+        }
+        prep_block = nullptr;
+        planner.discard_current_block();
+    }
+
+    // Time of the segments not done yet, only called from the segment preparation side.
+    uint64_t queued_segments_time_us()
+    {
+        uint64_t time_us = 0;
+        uint8_t head = segment_buffer_head.load(std::memory_order_relaxed);
+        for(uint8_t index = segment_buffer_tail.load(std::memory_order_acquire); index != head; index = (index + 1) & (SEGMENTS - 1))
+            time_us += segment_buffer[index].duration_us;
+        return time_us;
+    }
+
+    Planner<AXES, BLOCKS>& planner;
+    Motors& motors;
+
+    // Every block has at least one segment, so a block entry is never reused while a queued segment refers to it.
+    stepper_block_t stepper_block_buffer[SEGMENTS] = {};
+    segment_t segment_buffer[SEGMENTS];
+    // Single producer, single consumer: only the segment preparation moves the head, only the step interrupt the tail.
+    std::atomic<uint8_t> segment_buffer_head{0};   // Index of the next segment to be prepared
+    std::atomic<uint8_t> segment_buffer_tail{0};   // Index of the segment being executed
+
+    // Step interrupt state
+    segment_t* current_segment = nullptr;
+    stepper_block_t* current_block = nullptr;
+    unsigned int current_steps[AXES] = {};
+    int counters[AXES] = {};
+
+    // Segment preparation state, only used outside the interrupt
+    Block* prep_block = nullptr;
+    uint8_t prep_block_index = 0;
+    unsigned int step_events_completed = 0;
+    unsigned int acceleration_time_us = 0;
+    unsigned int acceleration_step_rate = 0;
+    unsigned int deceleration_time_us = 0;
+    unsigned int block_time_us = 0;              // Duration of the segments prepared for prep_block so far
+    uint64_t prepared_time_us = 0;               // Duration of all segments prepared since the start
+    // Pen lead: a pen change that follows prep_block is started on the first segment that begins less
+    // than the lead time before the estimated end of prep_block.
+    block_type_t lead_command = BLOCK_MOTION;    // Pen change to start early, BLOCK_MOTION for none
+    unsigned int lead_start_us = 0;
+    bool lead_started = false;
+    unsigned int lead_time_us = 0;               // Time between the early pen change and the end of its motion block
+};
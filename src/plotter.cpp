@@ -0,0 +1,259 @@
+#include "plotter.h"
+#include "motion/stepper.h"
+#include "motion/planner.h"
+#include "motion/plannerConfig.h"
+#include "fonts.h"
+#include "arch/sleep.h"
+#include <math.h>
+#include <string.h>
+
+
+float text_scale = 10.0f / 1000.0f;
+float travel_speed = 3000.0;
+float draw_speed = 1000.0;
+float path_tolerance = 0.025;
+float curve_tolerance = 0.025;
+plot_statistics_t plot_statistics;
+plot_recorder_t* plot_recorder;
+
+static float current_position[INPUT_AXIS_COUNT];
+static bool pen_is_down;
+
+// Drawing moves pass through a streaming simplification before the planner. Points are held back while a
+// single move from the anchor, the last point sent to the planner, to the newest point stays within
+// path_tolerance of all of them. At most simplify_window_size points are held back.
+static constexpr int simplify_window_size = 16;
+static float simplify_anchor[INPUT_AXIS_COUNT];
+static float simplify_window[simplify_window_size][INPUT_AXIS_COUNT];
+static int simplify_count;
+
+void wait_for_planner_done()
+{
+    while(planner_buf_free_positions() != BLOCK_BUFFER_SIZE - 1 || !stepper_is_idle()) {
+        stepper_prepare_segments();
+        arch_sleep(1);
+    }
+}
+
+// Segments are only prepared while waiting for room in the planner, so the planner has a full
+// buffer to look ahead over before the oldest block is handed to the stepper.
+void buffer_line(const float (&position)[INPUT_AXIS_COUNT], float feed_rate)
+{
+    if (plot_recorder) {
+        plot_recorder->line(plot_recorder->context, position, feed_rate, 100);
+    } else {
+        uint8_t head = block_buffer_head.load(std::memory_order_relaxed);
+        while(!planner_buffer_line(position, feed_rate, 100)) {
+            stepper_prepare_segments();
+            arch_sleep(1);
+        }
+        if (block_buffer_head.load(std::memory_order_relaxed) != head)
+            plot_statistics.blocks++;
+    }
+
+    float distance = 0;
+    for(int n=0; n<INPUT_AXIS_COUNT; n++) {
+        distance += (position[n] - current_position[n]) * (position[n] - current_position[n]);
+        current_position[n] = position[n];
+    }
+    if (pen_is_down)
+        plot_statistics.draw_distance += sqrtf(distance);
+    else
+        plot_statistics.travel_distance += sqrtf(distance);
+}
+
+// Queue a pen change, waiting for room in the planner buffer.
+static void buffer_pen(bool down)
+{
+    if (plot_recorder) {
+        plot_recorder->pen(plot_recorder->context, down);
+    } else {
+        while(!planner_buffer_pen(down)) {
+            stepper_prepare_segments();
+            arch_sleep(1);
+        }
+    }
+    pen_is_down = down;
+    if (!down)
+        plot_statistics.pen_lifts++;
+}
+
+// Distance of point to the line segment from start to end.
+static float distance_to_segment(const float (&point)[INPUT_AXIS_COUNT], const float (&start)[INPUT_AXIS_COUNT], const float (&end)[INPUT_AXIS_COUNT])
+{
+    float dot = 0, length2 = 0;
+    for(int n=0; n<INPUT_AXIS_COUNT; n++) {
+        dot += (point[n] - start[n]) * (end[n] - start[n]);
+        length2 += (end[n] - start[n]) * (end[n] - start[n]);
+    }
+    float t = length2 > 0 ? fminf(fmaxf(dot / length2, 0.0f), 1.0f) : 0.0f;
+    float distance2 = 0;
+    for(int n=0; n<INPUT_AXIS_COUNT; n++) {
+        float d = point[n] - (start[n] + t * (end[n] - start[n]));
+        distance2 += d * d;
+    }
+    return sqrtf(distance2);
+}
+
+// Send the newest held back point to the planner, it becomes the new anchor.
+static void flush_draw_lines()
+{
+    if (!simplify_count)
+        return;
+    auto& end = simplify_window[simplify_count - 1];
+    buffer_line(end, draw_speed);
+    for(int n=0; n<INPUT_AXIS_COUNT; n++)
+        simplify_anchor[n] = end[n];
+    plot_statistics.simplified_points += simplify_count - 1;
+    simplify_count = 0;
+}
+
+// Queue a drawing move through the simplification.
+static void draw_line(const float (&position)[INPUT_AXIS_COUNT])
+{
+    bool fits = simplify_count < simplify_window_size;
+    for(int idx=0; fits && idx<simplify_count; idx++)
+        fits = distance_to_segment(simplify_window[idx], simplify_anchor, position) <= path_tolerance;
+    if (!fits)
+        flush_draw_lines();
+    for(int n=0; n<INPUT_AXIS_COUNT; n++)
+        simplify_window[simplify_count][n] = position[n];
+    simplify_count++;
+}
+
+static void set_position(const float (&position)[INPUT_AXIS_COUNT])
+{
+    planner_set_position(position);
+    for(int n=0; n<INPUT_AXIS_COUNT; n++)
+        current_position[n] = position[n];
+}
+
+// Plot the strokes of a glyph at offset, in font units, from origin. The pen changes are queued
+// in the planner with the moves, so this never waits for the planner to drain.
+static void plot_strokes(font_glyph_iterator_t& glyph, const float (&origin)[INPUT_AXIS_COUNT], float offset, float scale)
+{
+    float pos[INPUT_AXIS_COUNT] = {};
+    float x, y;
+    while(font_next_stroke(glyph)) {
+        // First move
+        font_next_point(glyph, x, y);
+        pos[0] = origin[0] + (offset + x) * scale;
+        pos[1] = origin[1] + y * scale;
+        buffer_line(pos, travel_speed);
+        buffer_pen(true);
+        for(int n=0; n<INPUT_AXIS_COUNT; n++)
+            simplify_anchor[n] = pos[n];
+        while(font_next_point(glyph, x, y)) {
+            pos[0] = origin[0] + (offset + x) * scale;
+            pos[1] = origin[1] + y * scale;
+            draw_line(pos);
+        }
+        flush_draw_lines();
+        buffer_pen(false);
+    }
+}
+
+void plot_glyph(int c)
+{
+    font_glyph_iterator_t glyph;
+    if (!font_get_glyph(c, glyph, curve_tolerance / text_scale))
+        return;
+    float pos[2] = {0, 0};
+    set_position(pos);
+    plot_strokes(glyph, pos, 0, text_scale);
+    pos[0] = float(font_get_advance(c)) * text_scale;
+    pos[1] = 0;
+    buffer_line(pos, travel_speed);
+    wait_for_planner_done();
+}
+
+bool plot_text(const char* text, const char* font, float scale, const float (&origin)[INPUT_AXIS_COUNT])
+{
+    if (!font_set(font))
+        return false;
+    float offset = 0;
+    for(; *text; text++) {
+        font_glyph_iterator_t glyph;
+        if (font_get_glyph(*text, glyph, curve_tolerance / scale))
+            plot_strokes(glyph, origin, offset, scale);
+        offset += float(font_get_advance(*text));
+    }
+    // Travel moves between glyphs go straight to the next stroke, only the end of the text is moved to explicitly.
+    float pos[INPUT_AXIS_COUNT] = {};
+    pos[0] = origin[0] + offset * scale;
+    pos[1] = origin[1];
+    buffer_line(pos, travel_speed);
+    if (!plot_recorder)
+        wait_for_planner_done();
+    return true;
+}
+
+// Scratch planner of estimate_text_time_us(). Blocks are taken out when it is full, like the stepper would.
+static Planner<OUTPUT_AXIS_COUNT, BLOCK_BUFFER_SIZE> estimate_planner(planner_position_to_steps);
+static uint64_t estimate_time_us;
+static unsigned int estimate_previous_move_us;
+
+static void estimate_take_block()
+{
+    // Keep the machine going while estimating during a plot, like the wait in buffer_line() does.
+    stepper_prepare_segments();
+    const block_t* block = estimate_planner.get_current_block();
+    unsigned int block_us = estimate_planner.block_time_us(block, estimate_previous_move_us);
+    estimate_time_us += block_us;
+    estimate_previous_move_us = block->type == BLOCK_MOTION ? block_us : 0;
+    estimate_planner.discard_current_block();
+}
+
+static void estimate_line(void*, const float (&position)[INPUT_AXIS_COUNT], float feed_rate, float acceleration)
+{
+    while(!estimate_planner.buffer_line(position, feed_rate, acceleration))
+        estimate_take_block();
+}
+
+static void estimate_pen(void*, bool down)
+{
+    while(!estimate_planner.buffer_pen(down))
+        estimate_take_block();
+}
+
+uint64_t estimate_text_time_us(const char* text, const char* font, float scale, const float (&origin)[INPUT_AXIS_COUNT])
+{
+    memcpy(estimate_planner.max_feedrate, max_feedrate, sizeof(estimate_planner.max_feedrate));
+    memcpy(estimate_planner.max_acceleration_units_per_sq_second, max_acceleration_units_per_sq_second, sizeof(estimate_planner.max_acceleration_units_per_sq_second));
+    memcpy(estimate_planner.axis_steps_per_unit, axis_steps_per_unit, sizeof(estimate_planner.axis_steps_per_unit));
+    estimate_planner.minimumfeedrate = minimumfeedrate;
+    estimate_planner.max_xy_jerk = max_xy_jerk;
+    estimate_planner.max_z_jerk = max_z_jerk;
+    estimate_planner.init();
+    estimate_planner.set_position(current_position);
+    estimate_time_us = 0;
+    estimate_previous_move_us = 0;
+
+    // Recording changes the plot state, put it back afterwards.
+    float position[INPUT_AXIS_COUNT];
+    memcpy(position, current_position, sizeof(position));
+    bool pen_was_down = pen_is_down;
+    plot_statistics_t statistics = plot_statistics;
+    const char* previous_font = font_get_current();
+    plot_recorder_t* recorder = plot_recorder;
+    plot_recorder_t estimate_recorder{estimate_line, estimate_pen, nullptr};
+    plot_recorder = &estimate_recorder;
+    plot_text(text, font, scale, origin);
+    plot_recorder = recorder;
+    memcpy(current_position, position, sizeof(position));
+    pen_is_down = pen_was_down;
+    plot_statistics = statistics;
+    font_set(previous_font);
+
+    while(estimate_planner.blocks_queued())
+        estimate_take_block();
+    return estimate_time_us;
+}
+
+float plot_progress(uint64_t start_us, uint64_t total_us)
+{
+    uint64_t elapsed_us = stepper_elapsed_time_us() - start_us;
+    if (total_us == 0 || elapsed_us >= total_us)
+        return 1.0f;
+    return float(elapsed_us) / float(total_us);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "config/planner.h"
+#include <stdint.h>
+
+extern float text_scale;
+extern float travel_speed;
+extern float draw_speed;
+// Drawing moves are merged while the merged move stays within this distance (mm) of the original points.
+// 0 sends every point to the planner.
+extern float path_tolerance;
+// Curves of glyphs are flattened into lines that stay within this distance (mm) of the curve at the plotted scale.
+extern float curve_tolerance;
+
+// Counters of everything sent to the planner, for comparing the machine time of different plots.
+typedef struct {
+    unsigned int blocks;          // Number of blocks added to the planner
+    unsigned int simplified_points; // Number of drawing points merged into longer moves, each one a block less
+    unsigned int pen_lifts;       // Number of times the pen went up
+    float draw_distance;          // Length of the moves with the pen down in mm
+    float travel_distance;        // Length of the moves with the pen up in mm
+} plot_statistics_t;
+
+extern plot_statistics_t plot_statistics;
+
+// Receives the moves and pen changes of plot_text() instead of the planner, so a job can be planned offline.
+// Set plot_recorder to NULL, the default, to plot on the machine.
+typedef struct {
+    void (*line)(void* context, const float (&position)[INPUT_AXIS_COUNT], float feed_rate, float acceleration);
+    void (*pen)(void* context, bool down);
+    void* context;
+} plot_recorder_t;
+
+extern plot_recorder_t* plot_recorder;
+
+// Queue a line to position, waiting for room in the planner buffer.
+void buffer_line(const float (&position)[INPUT_AXIS_COUNT], float feed_rate);
+// Wait until all queued moves are done.
+void wait_for_planner_done();
+// Plot a single glyph of the current font, starting at the current position.
+// Resets the planner position to 0,0 and waits until the glyph is done.
+void plot_glyph(int c);
+// Plot text in font, starting at origin in mm, with scale in mm per font unit. Glyphs are placed after each
+// other with their advances, and all moves and pen changes stream into the planner without draining it.
+// Returns false when the font does not exist.
+bool plot_text(const char* text, const char* font, float scale, const float (&origin)[INPUT_AXIS_COUNT]);
+
+// Estimated time in microseconds to plot text with plot_text() from the end of the queued moves. The text is planned
+// on a scratch planner with the settings of the machine planner and summed with Planner::block_time_us(). This costs
+// about as much as planning the text. Segments are prepared in between, so it can be called while the machine plots.
+uint64_t estimate_text_time_us(const char* text, const char* font, float scale, const float (&origin)[INPUT_AXIS_COUNT]);
+// Progress from 0 to 1 of a plot that takes total_us, started when stepper_elapsed_time_us() was start_us.
+float plot_progress(uint64_t start_us, uint64_t total_us);
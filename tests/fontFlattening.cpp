@@ -0,0 +1,148 @@
+// Flattens the curves of tests/TestCurves.svg, and checks that the lines stay within the tolerance of the analytic
+// curves, and that the glyphs drawn in reverse in the SVG flatten to the same points as the forward ones.
+#include "fonts.h"
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+
+struct Point {
+    double x, y;
+};
+
+// The curves of the test font, with the same control points as the SVG.
+struct TestCurve {
+    char codepoint;
+    char reversed;               // Glyph of the same curve drawn from its end to its start
+    int type;                    // 2 quad, 3 cubic, 1 arc
+    Point p[4];                  // Bezier: start, controls and end. Arc: start, center, end
+    bool ccw;
+};
+
+static const TestCurve test_curves[] = {
+    {'Q', 'q', 2, {{0, 0}, {500, 1000}, {1000, 0}}, false},
+    {'C', 'c', 3, {{0, 0}, {0, 1000}, {1000, -500}, {1000, 500}}, false},
+    {'0', 'a', 1, {{0, 0}, {300, -400}, {600, 0}}, false},
+    {'1', 'b', 1, {{0, 0}, {300, 400}, {600, 0}}, true},
+    {'2', 'd', 1, {{0, 0}, {300, 400}, {600, 0}}, false},
+    {'3', 'e', 1, {{0, 0}, {300, -400}, {600, 0}}, true},
+};
+
+static const float tolerances[] = {0.5f, 2, 10, 50};
+
+// Dense enough that the distance to this polyline equals the distance to the curve to well within 0.01 units.
+static constexpr int curve_samples = 20000;
+static constexpr double epsilon = 0.01;
+
+static int failures;
+
+static Point curve_point(const TestCurve& curve, double t)
+{
+    const Point* p = curve.p;
+    double u = 1 - t;
+    if (curve.type == 2)
+        return {u * u * p[0].x + 2 * u * t * p[1].x + t * t * p[2].x, u * u * p[0].y + 2 * u * t * p[1].y + t * t * p[2].y};
+    if (curve.type == 3)
+        return {u * u * u * p[0].x + 3 * u * u * t * p[1].x + 3 * u * t * t * p[2].x + t * t * t * p[3].x,
+            u * u * u * p[0].y + 3 * u * u * t * p[1].y + 3 * u * t * t * p[2].y + t * t * t * p[3].y};
+    double radius = hypot(p[0].x - p[1].x, p[0].y - p[1].y);
+    double start = atan2(p[0].y - p[1].y, p[0].x - p[1].x);
+    double sweep = atan2(p[2].y - p[1].y, p[2].x - p[1].x) - start;
+    if (curve.ccw && sweep <= 0)
+        sweep += 2 * M_PI;
+    else if (!curve.ccw && sweep >= 0)
+        sweep -= 2 * M_PI;
+    return {p[1].x + radius * cos(start + sweep * t), p[1].y + radius * sin(start + sweep * t)};
+}
+
+static double segment_distance(Point p, Point a, Point b)
+{
+    double dx = b.x - a.x, dy = b.y - a.y;
+    double length = dx * dx + dy * dy;
+    double t = length > 0 ? fmin(fmax(((p.x - a.x) * dx + (p.y - a.y) * dy) / length, 0), 1) : 0;
+    return hypot(p.x - (a.x + t * dx), p.y - (a.y + t * dy));
+}
+
+static double polyline_distance(Point p, const std::vector<Point>& line)
+{
+    double distance = HUGE_VAL;
+    for(size_t n=1; n<line.size(); n++)
+        distance = fmin(distance, segment_distance(p, line[n - 1], line[n]));
+    return distance;
+}
+
+static std::vector<Point> flatten(char codepoint, float tolerance)
+{
+    std::vector<Point> points;
+    font_glyph_iterator_t glyph;
+    if (!font_get_glyph(codepoint, glyph, tolerance)) {
+        printf("'%c': no glyph\n", codepoint);
+        failures++;
+        return points;
+    }
+    int strokes = 0;
+    float x, y;
+    while(font_next_stroke(glyph)) {
+        strokes++;
+        while(font_next_point(glyph, x, y))
+            points.push_back({x, y});
+    }
+    if (strokes != 1) {
+        printf("'%c': %d strokes instead of 1\n", codepoint, strokes);
+        failures++;
+    }
+    return points;
+}
+
+static void check_curve(const TestCurve& curve, float tolerance)
+{
+    std::vector<Point> points = flatten(curve.codepoint, tolerance);
+    if (points.size() < 2)
+        return;
+
+    std::vector<Point> samples;
+    for(int n=0; n<=curve_samples; n++)
+        samples.push_back(curve_point(curve, double(n) / curve_samples));
+
+    // Every point lies on the curve, and every part of the curve is within tolerance of the lines.
+    double point_error = 0, line_error = 0;
+    for(const Point& point : points)
+        point_error = fmax(point_error, polyline_distance(point, samples));
+    for(const Point& sample : samples)
+        line_error = fmax(line_error, polyline_distance(sample, points));
+    if (point_error > epsilon || line_error > tolerance + epsilon) {
+        printf("'%c' at tolerance %g: %zu points up to %g off the curve, the curve up to %g from the lines\n",
+            curve.codepoint, tolerance, points.size(), point_error, line_error);
+        failures++;
+    }
+
+    // The reversed glyph may be flipped back by convert.py, so compare in both directions.
+    std::vector<Point> reversed = flatten(curve.reversed, tolerance);
+    bool same = reversed.size() == points.size();
+    bool same_reversed = same;
+    for(size_t n=0; n<points.size() && (same || same_reversed); n++) {
+        const Point& point = points[n];
+        if (same && hypot(reversed[n].x - point.x, reversed[n].y - point.y) > epsilon)
+            same = false;
+        const Point& other = reversed[reversed.size() - 1 - n];
+        if (same_reversed && hypot(other.x - point.x, other.y - point.y) > epsilon)
+            same_reversed = false;
+    }
+    if (!same && !same_reversed) {
+        printf("'%c' at tolerance %g: reversed glyph '%c' flattens to different points (%zu instead of %zu)\n",
+            curve.codepoint, tolerance, curve.reversed, reversed.size(), points.size());
+        failures++;
+    }
+}
+
+int main()
+{
+    if (!font_set("TestCurves")) {
+        printf("TestCurves font missing\n");
+        return 1;
+    }
+    for(const TestCurve& curve : test_curves)
+        for(float tolerance : tolerances)
+            check_curve(curve, tolerance);
+    printf("%zu curves checked, %d failures\n", sizeof(test_curves) / sizeof(test_curves[0]), failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,62 @@
+// Plans a move in every direction around a full circle, and checks that no axis accelerates faster than its limit,
+// and that moves along an axis get the full acceleration of that axis.
+#include "motion/planner.h"
+#include <stdio.h>
+#include <math.h>
+
+typedef Planner<OUTPUT_AXIS_COUNT, BLOCK_BUFFER_SIZE> TestPlanner;
+
+static constexpr int direction_count = 3600;
+// Higher than any axis allows, so the axis limits decide the acceleration.
+static constexpr float requested_acceleration = 1000000;
+
+static TestPlanner planner;
+static int failures;
+
+static const block_t* plan_move(float angle)
+{
+    float position[INPUT_AXIS_COUNT] = {};
+    planner.init();
+    planner.set_position(position);
+    position[0] = 10 * cosf(angle);
+    position[1] = 10 * sinf(angle);
+    if (!planner.buffer_line(position, 100, requested_acceleration) || !planner.blocks_queued())
+        return nullptr;
+    return planner.get_current_block();
+}
+
+int main()
+{
+    for(int direction=0; direction<direction_count; direction++) {
+        float angle = 2 * M_PI * direction / direction_count;
+        const block_t* block = plan_move(angle);
+        if (!block) {
+            printf("%.1f degrees: no block planned\n", 360.0 * direction / direction_count);
+            failures++;
+            continue;
+        }
+        for(int n=0; n<OUTPUT_AXIS_COUNT; n++) {
+            uint64_t axis_acceleration = uint64_t(block->acceleration_st) * block->steps[n] / block->step_event_count;
+            if (axis_acceleration > planner.axis_steps_per_sqr_second[n]) {
+                printf("%.1f degrees: axis %d accelerates at %llu steps/s^2, the limit is %lu\n", 360.0 * direction / direction_count, n,
+                    (unsigned long long)axis_acceleration, planner.axis_steps_per_sqr_second[n]);
+                failures++;
+            }
+        }
+    }
+
+    // Along an axis only that axis moves, so it gets all of its acceleration.
+    for(int n=0; n<OUTPUT_AXIS_COUNT && n<2; n++) {
+        for(int sign=0; sign<2; sign++) {
+            float angle = M_PI / 2 * n + M_PI * sign;
+            const block_t* block = plan_move(angle);
+            if (!block || block->acceleration_st != planner.axis_steps_per_sqr_second[n]) {
+                printf("axis %d: acceleration is %u steps/s^2, the axis allows %lu\n", n, block ? block->acceleration_st : 0, planner.axis_steps_per_sqr_second[n]);
+                failures++;
+            }
+        }
+    }
+
+    printf("%d directions planned, %d failures\n", direction_count, failures);
+    return failures ? 1 : 0;
+}
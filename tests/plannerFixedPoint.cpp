@@ -0,0 +1,159 @@
+// Plans the same random moves with the float and the fixed point planner, and checks that the blocks stay within
+// the tolerance documented in motion/fixedPoint.h. The planner type is chosen at compile time, so this is built
+// twice: without PLANNER_FIXED_POINT it prints the planned blocks, with it it runs the float build given as its
+// argument and compares the blocks of both.
+#include "motion/planner.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+typedef Planner<OUTPUT_AXIS_COUNT, BLOCK_BUFFER_SIZE> TestPlanner;
+
+static constexpr int move_count = 40000;
+
+static TestPlanner planner;
+static uint32_t random_state = 12345;
+
+// Deterministic, so both builds plan the same moves.
+static float random_float(float min, float max)
+{
+    random_state = random_state * 1664525u + 1013904223u;
+    return min + (max - min) * float(random_state >> 8) / float(1 << 24);
+}
+
+#ifndef PLANNER_FIXED_POINT
+static void print_block(FILE* f, const block_t& block)
+{
+    fprintf(f, "%d", block.type);
+    for(int n=0; n<OUTPUT_AXIS_COUNT; n++)
+        fprintf(f, " %u", block.steps[n]);
+    fprintf(f, " %u %u %u %u %u %u %u\n", block.step_event_count, block.nominal_rate, block.initial_rate, block.final_rate,
+        block.acceleration_st, block.accelerate_until, block.decelerate_after);
+}
+
+static void take_block()
+{
+    print_block(stdout, *planner.get_current_block());
+    planner.discard_current_block();
+}
+#else
+static bool read_block(FILE* f, block_t& block)
+{
+    int type;
+    if (fscanf(f, "%d", &type) != 1)
+        return false;
+    block.type = block_type_t(type);
+    for(int n=0; n<OUTPUT_AXIS_COUNT; n++)
+        if (fscanf(f, "%u", &block.steps[n]) != 1)
+            return false;
+    return fscanf(f, "%u %u %u %u %u %u %u", &block.step_event_count, &block.nominal_rate, &block.initial_rate, &block.final_rate,
+        &block.acceleration_st, &block.accelerate_until, &block.decelerate_after) == 7;
+}
+
+static FILE* float_blocks;
+static int block_count;
+static int failures;
+static int junction_outliers;
+
+static bool within(unsigned int value, unsigned int expected, double tolerance)
+{
+    return fabs(double(value) - double(expected)) <= tolerance;
+}
+
+static void check(bool ok, const char* field, unsigned int value, unsigned int expected)
+{
+    if (ok)
+        return;
+    if (failures < 20)
+        fprintf(stderr, "block %d: %s is %u, float planner %u\n", block_count, field, value, expected);
+    failures++;
+}
+
+static void take_block()
+{
+    const block_t* block = planner.get_current_block();
+    block_t expected;
+    if (!read_block(float_blocks, expected)) {
+        fprintf(stderr, "block %d: missing from the float planner\n", block_count);
+        exit(1);
+    }
+    check(block->type == expected.type, "type", block->type, expected.type);
+    for(int n=0; n<OUTPUT_AXIS_COUNT; n++)
+        check(block->steps[n] == expected.steps[n], "steps", block->steps[n], expected.steps[n]);
+    check(block->step_event_count == expected.step_event_count, "step_event_count", block->step_event_count, expected.step_event_count);
+    if (block->type == BLOCK_MOTION) {
+        double rate_tolerance = expected.step_event_count > 2 ? 0.002 : 0.01;
+        check(within(block->nominal_rate, expected.nominal_rate, fmax(expected.nominal_rate * rate_tolerance, 1)), "nominal_rate", block->nominal_rate, expected.nominal_rate);
+        check(within(block->acceleration_st, expected.acceleration_st, fmax(expected.acceleration_st * rate_tolerance, 1)), "acceleration_st", block->acceleration_st, expected.acceleration_st);
+        check(within(block->initial_rate, expected.initial_rate, fmax(expected.initial_rate * 0.02, 20)), "initial_rate", block->initial_rate, expected.initial_rate);
+        check(within(block->final_rate, expected.final_rate, fmax(expected.final_rate * 0.02, 20)), "final_rate", block->final_rate, expected.final_rate);
+        if (!within(block->initial_rate, expected.initial_rate, fmax(expected.initial_rate * 0.002, 5))
+            || !within(block->final_rate, expected.final_rate, fmax(expected.final_rate * 0.002, 5)))
+            junction_outliers++;
+        check(within(block->accelerate_until, expected.accelerate_until, 2), "accelerate_until", block->accelerate_until, expected.accelerate_until);
+        check(within(block->decelerate_after, expected.decelerate_after, 2), "decelerate_after", block->decelerate_after, expected.decelerate_after);
+    }
+    block_count++;
+    planner.discard_current_block();
+}
+#endif
+
+static void plan_moves()
+{
+    float position[INPUT_AXIS_COUNT] = {};
+    planner.set_position(position);
+    for(int move=0; move<move_count; move++) {
+        if (random_float(0, 1) < 0.05f) {
+            while(!planner.buffer_pen(random_float(0, 1) < 0.5f))
+                take_block();
+            continue;
+        }
+        // Mostly short moves like flattened curves, some only a few steps long, and some long travel moves.
+        float length = random_float(0, 1) < 0.1f ? random_float(10, 200) : random_float(0.01f, 2);
+        float angle = random_float(0, 2 * M_PI);
+        position[0] = fminf(fmaxf(position[0] + length * cosf(angle), 0), 300);
+        position[1] = fminf(fmaxf(position[1] + length * sinf(angle), 0), 300);
+        float feed_rate = random_float(5, 300);
+        float acceleration = random_float(50, 2000);
+        while(!planner.buffer_line(position, feed_rate, acceleration))
+            take_block();
+    }
+    while(planner.blocks_queued())
+        take_block();
+}
+
+int main(int argc, char** argv)
+{
+#ifdef PLANNER_FIXED_POINT
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <float planner build of this test>\n", argv[0]);
+        return 1;
+    }
+    float_blocks = popen(argv[1], "r");
+    if (!float_blocks) {
+        perror(argv[1]);
+        return 1;
+    }
+    plan_moves();
+    block_t extra;
+    if (read_block(float_blocks, extra)) {
+        fprintf(stderr, "the float planner planned more than %d blocks\n", block_count);
+        failures++;
+    }
+    if (pclose(float_blocks) != 0) {
+        fprintf(stderr, "%s failed\n", argv[1]);
+        return 1;
+    }
+    if (junction_outliers > block_count / 10000) {
+        fprintf(stderr, "%d blocks with initial_rate or final_rate over 0.2%% or 5 steps/sec off\n", junction_outliers);
+        failures++;
+    }
+    printf("%d blocks compared, %d outside the tolerance, %d junction outliers\n", block_count, failures, junction_outliers);
+    return failures ? 1 : 0;
+#else
+    (void)argc;
+    (void)argv;
+    plan_moves();
+    return 0;
+#endif
+}
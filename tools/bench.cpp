@@ -0,0 +1,272 @@
+// Micro benchmarks of the planner and stepper hot paths on the host. Each result is printed as a
+// single JSON object per line, so runs can be compared by scripts:
+//   {"benchmark": "...", "workload": "...", "value": ..., "unit": "..."}
+// Build type matters, compare Release builds only.
+//
+// With the machine-time argument it instead plots every printable glyph of every font through the
+// planner and stepper on the simulation's virtual clock, and reports how long that takes on the machine.
+// The workload is <font>/glyphs for plot_glyph() per character, <font>/text for a plot_text() job.
+// The text job also reports estimate_text_time_us() and how far it is off from the simulated time.
+//
+// With the job-plan argument it plans a long text job per font offline with jobPlanner.h, once on a single
+// planner and once cut into chunks on all hardware threads, and checks that both give the same blocks.
+#include "motion/planner.h"
+#include "motion/stepper.h"
+#include "fonts.h"
+#include "plotter.h"
+#include "arch/pen.h"
+#include "simulation.h"
+#include "jobPlanner.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+// Same as buffer_line(), the feed rates and text scale come from plotter.h.
+static constexpr float acceleration = 100;
+
+struct Move
+{
+    float position[INPUT_AXIS_COUNT];
+    float feed_rate;
+};
+
+struct Workload
+{
+    const char* name;
+    std::vector<Move> moves;
+};
+
+static double seconds_since(bench_clock::time_point start)
+{
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+static void report(const char* benchmark, const char* workload, double value, const char* unit)
+{
+    printf("{\"benchmark\": \"%s\", \"workload\": \"%s\", \"value\": %.6g, \"unit\": \"%s\"}\n", benchmark, workload, value, unit);
+}
+
+// 100mm lines around a square, the planner reaches nominal speed on every block.
+static Workload long_lines()
+{
+    Workload w{"long_lines", {}};
+    for(int n=0; n<1000; n++) {
+        float x = (n & 2) ? 100 : 0;
+        float y = ((n + 1) & 2) ? 100 : 0;
+        w.moves.push_back({{x, y}, draw_speed});
+    }
+    return w;
+}
+
+// Every printable glyph of EMSHerculean side by side, dense polylines with travel moves in between.
+static Workload glyphs()
+{
+    Workload w{"glyphs", {}};
+    if (!font_set("EMSHerculean"))
+        return w;
+    float offset = 0;
+    for(int c=33; c<127; c++) {
+        font_glyph_iterator_t glyph;
+        if (!font_get_glyph(c, glyph, curve_tolerance / text_scale))
+            continue;
+        while(font_next_stroke(glyph)) {
+            float feed_rate = travel_speed;
+            float x, y;
+            while(font_next_point(glyph, x, y)) {
+                w.moves.push_back({{offset + x * text_scale, y * text_scale}, feed_rate});
+                feed_rate = draw_speed;
+            }
+        }
+        offset += float(font_get_advance(c)) * text_scale;
+    }
+    return w;
+}
+
+// Short moves with sharp corners, every junction limits the speed.
+static Workload zig_zags()
+{
+    Workload w{"zig_zags", {}};
+    for(int n=0; n<5000; n++)
+        w.moves.push_back({{n * 0.2f, (n & 1) ? 1.0f : 0.0f}, draw_speed});
+    return w;
+}
+
+// Blocks added per second, with the oldest block taken out as soon as the buffer is full,
+// so every call plans against a full buffer.
+static void bench_buffer_line(const Workload& w)
+{
+    const int repeat = 20;
+    size_t count = 0;
+    auto start = bench_clock::now();
+    for(int r=0; r<repeat; r++) {
+        planner_init();
+        for(const auto& move : w.moves) {
+            while(!planner_buffer_line(move.position, move.feed_rate, acceleration)) {
+                planner_get_current_block();
+                planner_discard_current_block();
+            }
+            count++;
+        }
+    }
+    report("buffer_line", w.name, count / seconds_since(start), "segments/s");
+}
+
+// Cost of a single planner_buffer_line() call as a function of the number of blocks already queued.
+// Nothing is taken out of the buffer, so the lookahead covers all queued blocks.
+static void bench_recalculate(const Workload& w)
+{
+    const int repeat = 200;
+    for(int occupancy=0; occupancy<BLOCK_BUFFER_SIZE - 1; occupancy++) {
+        if (size_t(occupancy) >= w.moves.size())
+            break;
+        std::vector<double> samples;
+        for(int r=0; r<repeat; r++) {
+            planner_init();
+            for(int n=0; n<occupancy; n++)
+                planner_buffer_line(w.moves[n].position, w.moves[n].feed_rate, acceleration);
+            auto start = bench_clock::now();
+            planner_buffer_line(w.moves[occupancy].position, w.moves[occupancy].feed_rate, acceleration);
+            samples.push_back(seconds_since(start));
+        }
+        // A single call is short enough for the occasional preemption to dominate an average, report the median.
+        std::nth_element(samples.begin(), samples.begin() + repeat / 2, samples.end());
+        char name[64];
+        snprintf(name, sizeof(name), "%s/occupancy_%d", w.name, occupancy);
+        report("recalculate", name, samples[repeat / 2] * 1e9, "ns/call");
+    }
+}
+
+// Cost per call of the step interrupt. Segments are prepared between small batches of interrupts,
+// which are not timed, so the batches never run out of prepared segments while blocks are queued.
+static void bench_step_interrupt(const Workload& w)
+{
+    const int batch = 8;
+    InterruptFunctionPtr step_interrupt = sim_step_interrupt();
+    planner_init();
+    size_t next_move = 0;
+    size_t calls = 0;
+    double total = 0;
+    while(next_move < w.moves.size() || !stepper_is_idle()) {
+        while(next_move < w.moves.size() && planner_buffer_line(w.moves[next_move].position, w.moves[next_move].feed_rate, acceleration))
+            next_move++;
+        stepper_prepare_segments();
+        auto start = bench_clock::now();
+        for(int n=0; n<batch; n++)
+            step_interrupt();
+        total += seconds_since(start);
+        calls += batch;
+    }
+    report("step_interrupt", w.name, total / calls * 1e9, "ns/call");
+}
+
+static void report_plot(const char* workload, uint64_t start_us)
+{
+    double distance = plot_statistics.draw_distance + plot_statistics.travel_distance;
+    report("plot_time", workload, (sim_time_us() - start_us) / 1000000.0, "s");
+    report("travel_distance", workload, plot_statistics.travel_distance, "mm");
+    report("pen_lifts", workload, plot_statistics.pen_lifts, "count");
+    report("blocks", workload, plot_statistics.blocks, "count");
+    report("eliminated_blocks", workload, plot_statistics.simplified_points, "count");
+    report("average_block_length", workload, plot_statistics.blocks ? distance / plot_statistics.blocks : 0, "mm");
+}
+
+// Simulated machine time of plotting all printable ASCII glyphs of each font. Once glyph by glyph
+// like the firmware plots its input, and once as a single text job with plot_text().
+static void bench_machine_time()
+{
+    char text[127 - 32 + 1] = {};
+    for(int c=32; c<127; c++)
+        text[c - 32] = c;
+    planner_init();
+    pen_init();
+    for(int index=0; font_get_name(index); index++) {
+        const char* name = font_get_name(index);
+        char workload[64];
+
+        font_set(name);
+        plot_statistics = {};
+        uint64_t start_us = sim_time_us();
+        for(int c=32; c<127; c++)
+            plot_glyph(c);
+        snprintf(workload, sizeof(workload), "%s/glyphs", name);
+        report_plot(workload, start_us);
+
+        float origin[INPUT_AXIS_COUNT] = {};
+        planner_set_position(origin);
+        plot_statistics = {};
+        double estimate = estimate_text_time_us(text, name, text_scale, origin) / 1000000.0;
+        start_us = sim_time_us();
+        plot_text(text, name, text_scale, origin);
+        snprintf(workload, sizeof(workload), "%s/text", name);
+        report_plot(workload, start_us);
+        double plot_time = (sim_time_us() - start_us) / 1000000.0;
+        report("estimated_time", workload, estimate, "s");
+        report("estimate_error", workload, (estimate - plot_time) / plot_time * 100, "%");
+    }
+}
+
+// Blocks planned per second by the offline job planner, sequential and in parallel, on a banner of every
+// printable glyph repeated. Returns false when the parallel plan differs from the sequential plan.
+static bool bench_job_plan()
+{
+    const int repeat = 50;
+    std::string text;
+    for(int r=0; r<repeat; r++)
+        for(int c=32; c<127; c++)
+            text += char(c);
+    bool identical = true;
+    for(int index=0; font_get_name(index); index++) {
+        const char* name = font_get_name(index);
+        Job job{};
+        job_record_text(job, text.c_str(), name, text_scale, job.start);
+
+        auto start = bench_clock::now();
+        std::vector<PlannedBlock> sequential = job_plan_sequential(job);
+        double sequential_time = seconds_since(start);
+        start = bench_clock::now();
+        std::vector<PlannedBlock> parallel = job_plan(job, 0);
+        double parallel_time = seconds_since(start);
+
+        char workload[64];
+        snprintf(workload, sizeof(workload), "%s/sequential", name);
+        report("job_plan", workload, sequential.size() / sequential_time, "blocks/s");
+        snprintf(workload, sizeof(workload), "%s/parallel", name);
+        report("job_plan", workload, parallel.size() / parallel_time, "blocks/s");
+        if (sequential != parallel) {
+            fprintf(stderr, "Parallel plan of %s differs from the sequential plan\n", name);
+            identical = false;
+        }
+    }
+    return identical;
+}
+
+int main(int argc, char** argv)
+{
+    stepper_init();
+    if (argc > 1 && strcmp(argv[1], "machine-time") == 0) {
+        bench_machine_time();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "job-plan") == 0)
+        return bench_job_plan() ? 0 : 1;
+    if (argc > 1) {
+        fprintf(stderr, "Usage: %s [machine-time|job-plan]\n", argv[0]);
+        return 1;
+    }
+    const Workload workloads[] = {long_lines(), glyphs(), zig_zags()};
+    for(const auto& w : workloads) {
+        if (w.moves.empty()) {
+            fprintf(stderr, "Workload %s is empty, skipped\n", w.name);
+            continue;
+        }
+        bench_buffer_line(w);
+        bench_recalculate(w);
+        bench_step_interrupt(w);
+    }
+    return 0;
+}
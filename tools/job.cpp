@@ -0,0 +1,89 @@
+// Compiles text jobs into planned blocks (see jobFile.h) and plays them on the simulation.
+//   penplotter_job compile <font> <text> <file>   Plan the text offline and write the blocks
+//   penplotter_job play <file>                    Feed the blocks to the stepper without planning
+//   penplotter_job plot <font> <text>             Plot the text through the planner, to compare with play
+// play and plot print the simulation report, and write the step trace named by PENPLOTTER_TRACE.
+#include "jobFile.h"
+#include "motion/stepper.h"
+#include "plotter.h"
+#include "arch/pen.h"
+#include "arch/sleep.h"
+#include "simulation.h"
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+using job_clock = std::chrono::steady_clock;
+
+static double seconds_since(job_clock::time_point start)
+{
+    return std::chrono::duration<double>(job_clock::now() - start).count();
+}
+
+static int compile(const char* font, const char* text, const char* filename)
+{
+    Job job{};
+    if (!job_record_text(job, text, font, text_scale, job.start)) {
+        fprintf(stderr, "Unknown font: %s\n", font);
+        return 1;
+    }
+    auto start = job_clock::now();
+    std::vector<PlannedBlock> blocks = job_plan(job, 0);
+    double plan_time = seconds_since(start);
+    if (!job_file_write(filename, blocks))
+        return 1;
+    printf("Blocks: %zu\n", blocks.size());
+    printf("Planned in: %.3f ms\n", plan_time * 1000);
+    return 0;
+}
+
+static int play(const char* filename)
+{
+    JobFile file;
+    if (!file.open(filename))
+        return 1;
+    auto start = job_clock::now();
+    block_t block;
+    for(size_t index=0; index<file.block_count(); index++) {
+        file.get_block(index, block);
+        while(!default_planner.buffer_planned(block)) {
+            stepper_prepare_segments();
+            arch_sleep(1);
+        }
+    }
+    wait_for_planner_done();
+    double play_time = seconds_since(start);
+    printf("Blocks: %zu\n", file.block_count());
+    printf("Played in: %.3f ms\n", play_time * 1000);
+    sim_report();
+    return 0;
+}
+
+static int plot(const char* font, const char* text)
+{
+    float origin[INPUT_AXIS_COUNT] = {};
+    auto start = job_clock::now();
+    if (!plot_text(text, font, text_scale, origin)) {
+        fprintf(stderr, "Unknown font: %s\n", font);
+        return 1;
+    }
+    double plot_time = seconds_since(start);
+    printf("Plotted in: %.3f ms\n", plot_time * 1000);
+    sim_report();
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    planner_init();
+    stepper_init();
+    pen_init();
+    if (argc == 5 && strcmp(argv[1], "compile") == 0)
+        return compile(argv[2], argv[3], argv[4]);
+    if (argc == 3 && strcmp(argv[1], "play") == 0)
+        return play(argv[2]);
+    if (argc == 4 && strcmp(argv[1], "plot") == 0)
+        return plot(argv[2], argv[3]);
+    fprintf(stderr, "Usage: %s compile <font> <text> <file> | play <file> | plot <font> <text>\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,190 @@
+#include "jobFile.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef S_CURVE_ACCELERATION
+static constexpr uint8_t build_flags = JOB_FILE_S_CURVE;
+static constexpr size_t block_fields = 8 + OUTPUT_AXIS_COUNT + 3;
+#else
+static constexpr uint8_t build_flags = 0;
+static constexpr size_t block_fields = 8 + OUTPUT_AXIS_COUNT;
+#endif
+static constexpr size_t block_size = 4 + 4 * block_fields;
+
+static uint32_t fnv1a(const uint8_t* data, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    for(size_t n=0; n<size; n++)
+        hash = (hash ^ data[n]) * 16777619u;
+    return hash;
+}
+
+static void put_u32(std::vector<uint8_t>& buffer, uint32_t value)
+{
+    for(int n=0; n<4; n++)
+        buffer.push_back(value >> (n * 8));
+}
+
+static uint32_t get_u32(const uint8_t* p)
+{
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+bool job_file_write(const char* filename, const std::vector<PlannedBlock>& blocks)
+{
+    std::vector<uint8_t> buffer(job_file_header_size);
+    for(const auto& block : blocks) {
+        buffer.push_back(block.type);
+        buffer.push_back(block.direction_bits);
+        buffer.push_back(0);
+        buffer.push_back(0);
+        put_u32(buffer, block.dwell_us);
+        put_u32(buffer, block.step_event_count);
+        put_u32(buffer, block.accelerate_until);
+        put_u32(buffer, block.decelerate_after);
+        put_u32(buffer, block.nominal_rate);
+        put_u32(buffer, block.initial_rate);
+        put_u32(buffer, block.final_rate);
+        put_u32(buffer, block.acceleration_st);
+        for(auto steps : block.steps)
+            put_u32(buffer, steps);
+#ifdef S_CURVE_ACCELERATION
+        put_u32(buffer, block.peak_rate);
+        put_u32(buffer, block.acceleration_us);
+        put_u32(buffer, block.deceleration_us);
+#endif
+    }
+
+    std::vector<uint8_t> header;
+    header.insert(header.end(), job_file_magic, job_file_magic + 4);
+    header.push_back(job_file_version);
+    header.push_back(OUTPUT_AXIS_COUNT);
+    header.push_back(build_flags);
+    header.push_back(0);
+    put_u32(header, blocks.size());
+    put_u32(header, fnv1a(buffer.data() + job_file_header_size, buffer.size() - job_file_header_size));
+    std::copy(header.begin(), header.end(), buffer.begin());
+
+    FILE* f = fopen(filename, "wb");
+    if (!f) {
+        perror(filename);
+        return false;
+    }
+    bool ok = fwrite(buffer.data(), 1, buffer.size(), f) == buffer.size();
+    ok = fclose(f) == 0 && ok;
+    if (!ok)
+        fprintf(stderr, "%s: write failed\n", filename);
+    return ok;
+}
+
+JobFile::~JobFile()
+{
+    if (data)
+        munmap(const_cast<uint8_t*>(data), size);
+}
+
+bool JobFile::open(const char* filename)
+{
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror(filename);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < job_file_header_size) {
+        fprintf(stderr, "%s: not a compiled job\n", filename);
+        close(fd);
+        return false;
+    }
+    size = st.st_size;
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        perror(filename);
+        return false;
+    }
+    data = static_cast<const uint8_t*>(mapping);
+
+    const char* error = nullptr;
+    if (memcmp(data, job_file_magic, sizeof(job_file_magic)) != 0)
+        error = "not a compiled job";
+    else if (data[4] != job_file_version)
+        error = "unsupported version";
+    else if (data[5] != OUTPUT_AXIS_COUNT)
+        error = "compiled for another axis count";
+    else if (data[6] != build_flags)
+        error = "compiled for another S-curve setting";
+    else if ((size - job_file_header_size) / block_size != get_u32(data + 8) || (size - job_file_header_size) % block_size != 0)
+        error = "size does not match the block count";
+    else if (fnv1a(data + job_file_header_size, size - job_file_header_size) != get_u32(data + 12))
+        error = "hash mismatch";
+    if (!error) {
+        count = get_u32(data + 8);
+        for(size_t index=0; index<count && !error; index++)
+            if (!check_block(index))
+                error = "invalid block";
+    }
+    if (error) {
+        fprintf(stderr, "%s: %s\n", filename, error);
+        munmap(mapping, size);
+        data = nullptr;
+        count = 0;
+        return false;
+    }
+    return true;
+}
+
+void JobFile::get_block(size_t index, block_t& block) const
+{
+    const uint8_t* p = data + job_file_header_size + index * block_size;
+    block.type = block_type_t(p[0]);
+    block.direction_bits = p[1];
+    p += 4;
+    block.dwell_us = get_u32(p);
+    block.step_event_count = get_u32(p + 4);
+    block.accelerate_until = get_u32(p + 8);
+    block.decelerate_after = get_u32(p + 12);
+    block.nominal_rate = get_u32(p + 16);
+    block.initial_rate = get_u32(p + 20);
+    block.final_rate = get_u32(p + 24);
+    block.acceleration_st = get_u32(p + 28);
+    p += 32;
+    for(auto& steps : block.steps) {
+        steps = get_u32(p);
+        p += 4;
+    }
+#ifdef S_CURVE_ACCELERATION
+    block.peak_rate = get_u32(p);
+    block.acceleration_us = get_u32(p + 4);
+    block.deceleration_us = get_u32(p + 8);
+#endif
+}
+
+// The stepper divides by the rates and counts up to the trapezoid indices, reject what would make it misbehave.
+bool JobFile::check_block(size_t index) const
+{
+    block_t block;
+    get_block(index, block);
+    if (block.type > BLOCK_DWELL)
+        return false;
+    if (block.type != BLOCK_MOTION)
+        return true;
+    unsigned int max_steps = 0;
+    for(auto steps : block.steps)
+        max_steps = std::max(max_steps, steps);
+    return block.step_event_count > 0 && block.step_event_count == max_steps
+        && block.step_event_count <= (~0u >> MAX_OVERSAMPLING_LEVEL)
+        && (block.direction_bits >> OUTPUT_AXIS_COUNT) == 0
+        && block.accelerate_until <= block.decelerate_after && block.decelerate_after <= block.step_event_count
+        && block.initial_rate > 0 && block.nominal_rate > 0 && block.final_rate > 0
+        && std::max({block.initial_rate, block.nominal_rate, block.final_rate}) <= STEPPER_MAX_STEP_RATE
+#ifdef S_CURVE_ACCELERATION
+        && block.peak_rate <= block.nominal_rate
+#endif
+        ;
+}
@@ -0,0 +1,50 @@
+// Compiled jobs: the planned blocks of a job in a file, so a job that is plotted again and again is planned once.
+// The blocks are fed to the stepper with Planner::buffer_planned(), skipping all planning.
+//
+// Header, 16 bytes:
+//   "PPJB", uint8 version, uint8 axis count, uint8 flags, uint8 0,
+//   uint32 block count, uint32 FNV-1a hash of all bytes after the header.
+// Then the blocks, all the same size. Each block is uint8 block_type_t, uint8 direction bits, uint16 0, then uint32
+//   dwell_us, step_event_count, accelerate_until, decelerate_after, nominal_rate, initial_rate, final_rate,
+//   acceleration_st, steps per axis, and with JOB_FILE_S_CURVE peak_rate, acceleration_us, deceleration_us.
+// All values are little endian. A command only has its type and dwell_us set, the rest is 0.
+#pragma once
+
+#include "jobPlanner.h"
+#include <stddef.h>
+#include <stdint.h>
+
+static constexpr char job_file_magic[4] = {'P', 'P', 'J', 'B'};
+static constexpr uint8_t job_file_version = 1;
+static constexpr size_t job_file_header_size = 16;
+
+enum JobFileFlags : uint8_t
+{
+    JOB_FILE_S_CURVE = 0x01,            // Blocks have the S_CURVE_ACCELERATION fields
+};
+
+// Write the planned blocks of a job. Returns false and prints the reason when the file cannot be written.
+bool job_file_write(const char* filename, const std::vector<PlannedBlock>& blocks);
+
+// A compiled job mapped into memory. Blocks are decoded from the mapping when they are fed to the planner.
+class JobFile
+{
+public:
+    ~JobFile();
+
+    // Map and validate a compiled job. Returns false and prints the reason when the file cannot be used:
+    // an unknown version, another axis count or S-curve setting than this build, a bad size or hash,
+    // or a block the stepper cannot execute.
+    bool open(const char* filename);
+
+    size_t block_count() const { return count; }
+    // Decode block index into a planner block.
+    void get_block(size_t index, block_t& block) const;
+
+private:
+    bool check_block(size_t index) const;
+
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    size_t count = 0;
+};
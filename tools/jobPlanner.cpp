@@ -0,0 +1,161 @@
+#include "jobPlanner.h"
+#include "plotter.h"
+#include "motion/plannerConfig.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+
+// Chunks are grouped up to at least this many commands, so the planner setup does not dominate short strokes.
+static constexpr size_t min_chunk_commands = 1024;
+
+typedef Planner<OUTPUT_AXIS_COUNT, BLOCK_BUFFER_SIZE> JobPlanner;
+
+bool operator==(const PlannedBlock& a, const PlannedBlock& b)
+{
+    if (a.type != b.type || a.dwell_us != b.dwell_us || a.step_event_count != b.step_event_count)
+        return false;
+    for(int n=0; n<OUTPUT_AXIS_COUNT; n++)
+        if (a.steps[n] != b.steps[n])
+            return false;
+    return a.accelerate_until == b.accelerate_until && a.decelerate_after == b.decelerate_after
+        && a.direction_bits == b.direction_bits && a.nominal_rate == b.nominal_rate
+        && a.initial_rate == b.initial_rate && a.final_rate == b.final_rate && a.acceleration_st == b.acceleration_st
+#ifdef S_CURVE_ACCELERATION
+        && a.peak_rate == b.peak_rate && a.acceleration_us == b.acceleration_us && a.deceleration_us == b.deceleration_us
+#endif
+        ;
+}
+
+static void record_line(void* context, const float (&position)[INPUT_AXIS_COUNT], float feed_rate, float acceleration)
+{
+    JobCommand command{BLOCK_MOTION, {}, feed_rate, acceleration, 0};
+    std::copy(position, position + INPUT_AXIS_COUNT, command.position);
+    static_cast<Job*>(context)->commands.push_back(command);
+}
+
+static void record_pen(void* context, bool down)
+{
+    static_cast<Job*>(context)->commands.push_back({down ? BLOCK_PEN_DOWN : BLOCK_PEN_UP, {}, 0, 0, 0});
+}
+
+bool job_record_text(Job& job, const char* text, const char* font, float scale, const float (&origin)[INPUT_AXIS_COUNT])
+{
+    plot_recorder_t recorder{record_line, record_pen, &job};
+    plot_recorder_t* previous_recorder = plot_recorder;
+    plot_recorder = &recorder;
+    bool result = plot_text(text, font, scale, origin);
+    plot_recorder = previous_recorder;
+    return result;
+}
+
+// Take the oldest block out of the planner, like the stepper does.
+static void take_block(JobPlanner& planner, std::vector<PlannedBlock>& blocks)
+{
+    const block_t* block = planner.get_current_block();
+    PlannedBlock planned{};
+    planned.type = block->type;
+    // Only the type and dwell time of a command are set.
+    if (block->type != BLOCK_MOTION) {
+        planned.dwell_us = block->dwell_us;
+    } else {
+        std::copy(block->steps, block->steps + OUTPUT_AXIS_COUNT, planned.steps);
+        planned.step_event_count = block->step_event_count;
+        planned.accelerate_until = block->accelerate_until;
+        planned.decelerate_after = block->decelerate_after;
+        planned.direction_bits = block->direction_bits;
+        planned.nominal_rate = block->nominal_rate;
+        planned.initial_rate = block->initial_rate;
+        planned.final_rate = block->final_rate;
+        planned.acceleration_st = block->acceleration_st;
+#ifdef S_CURVE_ACCELERATION
+        planned.peak_rate = block->peak_rate;
+        planned.acceleration_us = block->acceleration_us;
+        planned.deceleration_us = block->deceleration_us;
+#endif
+    }
+    blocks.push_back(planned);
+    planner.discard_current_block();
+}
+
+static void add_command(JobPlanner& planner, const JobCommand& command, std::vector<PlannedBlock>& blocks)
+{
+    while(true) {
+        bool added;
+        if (command.type == BLOCK_MOTION)
+            added = planner.buffer_line(command.position, command.feed_rate, command.acceleration);
+        else if (command.type == BLOCK_DWELL)
+            added = planner.buffer_dwell(command.dwell_us);
+        else
+            added = planner.buffer_pen(command.type == BLOCK_PEN_DOWN);
+        if (added)
+            return;
+        take_block(planner, blocks);
+    }
+}
+
+// Plan the commands from first up to last, where first is the start of the job or a command. Once a command is
+// planned, no block before it changes anymore and it is the oldest block the plan after it depends on. So the
+// command at last, if any, is planned as well, and stays behind in the planner as the start of the next chunk.
+static void plan_chunk(const Job& job, size_t first, size_t last, std::vector<PlannedBlock>& blocks)
+{
+    std::unique_ptr<JobPlanner> planner(new JobPlanner(planner_position_to_steps));
+    float position[INPUT_AXIS_COUNT];
+    std::copy(job.start, job.start + INPUT_AXIS_COUNT, position);
+    for(size_t index=first; index>0; index--) {
+        if (job.commands[index - 1].type == BLOCK_MOTION) {
+            std::copy(job.commands[index - 1].position, job.commands[index - 1].position + INPUT_AXIS_COUNT, position);
+            break;
+        }
+    }
+    planner->set_position(position);
+
+    for(size_t index=first; index<last; index++)
+        add_command(*planner, job.commands[index], blocks);
+    size_t keep = 0;
+    if (last < job.commands.size()) {
+        add_command(*planner, job.commands[last], blocks);
+        keep = 1;
+    }
+    while(size_t(BLOCK_BUFFER_SIZE - 1 - planner->buf_free_positions()) > keep)
+        take_block(*planner, blocks);
+}
+
+std::vector<PlannedBlock> job_plan(const Job& job, unsigned int thread_count)
+{
+    if (thread_count == 0)
+        thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+
+    // Cut at commands, every chunk starts at the start of the job or at a command.
+    std::vector<size_t> chunk_start{0};
+    for(size_t index=1; index<job.commands.size(); index++)
+        if (job.commands[index].type != BLOCK_MOTION && index - chunk_start.back() >= min_chunk_commands)
+            chunk_start.push_back(index);
+    chunk_start.push_back(job.commands.size());
+
+    size_t chunk_count = chunk_start.size() - 1;
+    std::vector<std::vector<PlannedBlock>> chunk_blocks(chunk_count);
+    std::atomic<size_t> next_chunk{0};
+    auto worker = [&]() {
+        for(size_t chunk = next_chunk++; chunk < chunk_count; chunk = next_chunk++)
+            plan_chunk(job, chunk_start[chunk], chunk_start[chunk + 1], chunk_blocks[chunk]);
+    };
+    std::vector<std::thread> threads;
+    for(unsigned int n=1; n<std::min<size_t>(thread_count, chunk_count); n++)
+        threads.emplace_back(worker);
+    worker();
+    for(auto& thread : threads)
+        thread.join();
+
+    std::vector<PlannedBlock> blocks;
+    for(const auto& chunk : chunk_blocks)
+        blocks.insert(blocks.end(), chunk.begin(), chunk.end());
+    return blocks;
+}
+
+std::vector<PlannedBlock> job_plan_sequential(const Job& job)
+{
+    std::vector<PlannedBlock> blocks;
+    plan_chunk(job, 0, job.commands.size(), blocks);
+    return blocks;
+}
@@ -0,0 +1,54 @@
+// Offline planning of complete jobs on the host. The job is planned by the same Planner as on the machine, with
+// blocks taken out of the buffer when it is full, like the stepper would. A pen change or dwell is a full stop,
+// after which the plan no longer depends on the moves before it, so the job is cut into chunks at those commands
+// and the chunks are planned in parallel. The result is identical to planning the whole job on one planner.
+#pragma once
+
+#include "motion/planner.h"
+#include <vector>
+
+struct JobCommand
+{
+    block_type_t type;                      // BLOCK_MOTION for a move
+    float position[INPUT_AXIS_COUNT];       // Target of a move
+    float feed_rate;
+    float acceleration;
+    unsigned int dwell_us;                  // Duration of a BLOCK_DWELL
+};
+
+struct Job
+{
+    float start[INPUT_AXIS_COUNT];          // Position of the machine before the first command
+    std::vector<JobCommand> commands;
+};
+
+// The fields of a planned block the stepper uses, see block_t.
+struct PlannedBlock
+{
+    block_type_t type;
+    unsigned int dwell_us;
+    unsigned int steps[OUTPUT_AXIS_COUNT];
+    unsigned int step_event_count;
+    unsigned int accelerate_until;
+    unsigned int decelerate_after;
+    unsigned char direction_bits;
+    unsigned int nominal_rate;
+    unsigned int initial_rate;
+    unsigned int final_rate;
+    unsigned int acceleration_st;
+#ifdef S_CURVE_ACCELERATION
+    unsigned int peak_rate;
+    unsigned int acceleration_us;
+    unsigned int deceleration_us;
+#endif
+};
+
+bool operator==(const PlannedBlock& a, const PlannedBlock& b);
+
+// Record the moves and pen changes of plot_text() into a job, instead of plotting them.
+bool job_record_text(Job& job, const char* text, const char* font, float scale, const float (&origin)[INPUT_AXIS_COUNT]);
+
+// Plan a job with thread_count threads, 0 for one per hardware thread. The planner uses the default settings.
+std::vector<PlannedBlock> job_plan(const Job& job, unsigned int thread_count);
+// Plan a job on a single planner without cutting it into chunks, the reference for job_plan().
+std::vector<PlannedBlock> job_plan_sequential(const Job& job);
@@ -0,0 +1,202 @@
+// Replays a binary step trace written by the simulation (see src/arch/sim/traceFormat.h)
+// and prints the job time, per axis peak velocity and acceleration and the pen events.
+#include "traceFormat.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+
+// The position of each axis is sampled every sample_us, interpolating linearly between steps.
+// Velocity is the change in position over window_samples, acceleration the change in velocity over window_samples.
+// Gaps between steps longer than max_gap_us count as standing still. On axes with few steps/mm the
+// acceleration includes step quantization noise, and junction speed changes show up as short peaks.
+static constexpr uint64_t sample_us = 1000;
+static constexpr size_t window_samples = 5;
+static constexpr uint64_t max_gap_us = 50000;
+
+struct Axis
+{
+    float steps_per_unit;
+    uint64_t steps;
+    int position;
+    uint64_t last_step_us;
+    std::vector<double> samples;  // Position in steps at each sample time
+
+    void sample_until(uint64_t time_us, int new_position)
+    {
+        uint64_t gap_us = time_us - last_step_us;
+        for(uint64_t t = samples.size() * sample_us; t <= time_us; t += sample_us) {
+            if (gap_us > 0 && gap_us <= max_gap_us)
+                samples.push_back(position + double(new_position - position) * (t - last_step_us) / gap_us);
+            else
+                samples.push_back(position);
+        }
+        position = new_position;
+        last_step_us = time_us;
+    }
+};
+
+class TraceReader
+{
+public:
+    TraceReader(FILE* f) : file(f) {}
+
+    bool read(uint8_t& value)
+    {
+        int c = fgetc(file);
+        if (c == EOF) {
+            error = true;
+            return false;
+        }
+        value = c;
+        return true;
+    }
+
+    uint64_t read_varint()
+    {
+        uint64_t value = 0;
+        uint8_t b = 0x80;
+        for(int shift=0; (b & 0x80) && shift < 64; shift += 7) {
+            if (!read(b))
+                return 0;
+            value |= uint64_t(b & 0x7F) << shift;
+        }
+        return value;
+    }
+
+    FILE* file;
+    bool error = false;
+};
+
+static bool replay(const char* filename)
+{
+    FILE* f = fopen(filename, "rb");
+    if (!f) {
+        perror(filename);
+        return false;
+    }
+    TraceReader reader(f);
+    char magic[4];
+    uint8_t version = 0, axis_count = 0, step_bits = 0;
+    if (fread(magic, 1, 4, f) != 4 || memcmp(magic, trace_magic, 4) != 0 || !reader.read(version) || version != trace_version
+        || !reader.read(axis_count) || !reader.read(step_bits) || axis_count == 0 || axis_count > 8 || step_bits == 0 || step_bits > 8) {
+        fprintf(stderr, "%s: not a version %d step trace\n", filename, trace_version);
+        fclose(f);
+        return false;
+    }
+    std::vector<Axis> axes(axis_count);
+    for(auto& axis : axes) {
+        uint32_t bits = 0;
+        for(int n=0; n<4; n++) {
+            uint8_t b = 0;
+            reader.read(b);
+            bits |= uint32_t(b) << (n * 8);
+        }
+        memcpy(&axis.steps_per_unit, &bits, sizeof(bits));
+        axis.steps = 0;
+        axis.position = 0;
+        axis.last_step_us = 0;
+    }
+
+    uint64_t time_us = 0;
+    uint8_t direction_bits = 0;
+    unsigned int pen_downs = 0, pen_ups = 0;
+    uint64_t pen_down_since_us = 0, pen_down_us = 0;
+    bool pen_is_down = false;
+    bool done = false;
+    std::vector<uint8_t> packed;
+    while(!done && !reader.error) {
+        uint8_t record;
+        if (!reader.read(record))
+            break;
+        switch(record) {
+        case TRACE_STEPS: {
+            uint64_t delta_us = reader.read_varint();
+            uint64_t ticks = reader.read_varint();
+            packed.resize((ticks * axis_count * step_bits + 7) / 8);
+            if (fread(packed.data(), 1, packed.size(), f) != packed.size()) {
+                reader.error = true;
+                break;
+            }
+            for(uint64_t tick=0; tick<ticks; tick++) {
+                time_us += delta_us;
+                for(size_t n=0; n<axis_count; n++) {
+                    uint64_t bit = (tick * axis_count + n) * step_bits;
+                    unsigned int value = packed[bit / 8] >> (bit % 8);
+                    if (bit % 8 + step_bits > 8)
+                        value |= packed[bit / 8 + 1] << (8 - bit % 8);
+                    value &= (1 << step_bits) - 1;
+                    if (!value)
+                        continue;
+                    auto& axis = axes[n];
+                    axis.sample_until(time_us, axis.position + ((direction_bits & (1 << n)) ? -int(value) : int(value)));
+                    axis.steps += value;
+                }
+            }
+            } break;
+        case TRACE_DIRECTION:
+            reader.read(direction_bits);
+            break;
+        case TRACE_PEN: {
+            time_us += reader.read_varint();
+            uint8_t down = 0;
+            reader.read(down);
+            if (down && !pen_is_down) {
+                pen_downs++;
+                pen_down_since_us = time_us;
+            } else if (!down && pen_is_down) {
+                pen_ups++;
+                pen_down_us += time_us - pen_down_since_us;
+            }
+            pen_is_down = down;
+            } break;
+        case TRACE_END:
+            time_us += reader.read_varint();
+            done = true;
+            break;
+        default:
+            fprintf(stderr, "%s: unknown record type %d\n", filename, record);
+            reader.error = true;
+            break;
+        }
+    }
+    fclose(f);
+    if (!done) {
+        fprintf(stderr, "%s: truncated trace\n", filename);
+        return false;
+    }
+
+    printf("%s\n", filename);
+    printf("  Total time: %.3f s\n", time_us / 1000000.0);
+    printf("  Pen down: %u, pen up: %u, pen down time: %.3f s\n", pen_downs, pen_ups, pen_down_us / 1000000.0);
+    for(size_t n=0; n<axis_count; n++) {
+        auto& axis = axes[n];
+        axis.sample_until(time_us, axis.position);
+        double window_s = window_samples * sample_us / 1000000.0;
+        std::vector<double> velocity(axis.samples.size());
+        double peak_velocity = 0, peak_acceleration = 0;
+        for(size_t idx=window_samples; idx<axis.samples.size(); idx++) {
+            velocity[idx] = (axis.samples[idx] - axis.samples[idx - window_samples]) / window_s / axis.steps_per_unit;
+            peak_velocity = std::max(peak_velocity, fabs(velocity[idx]));
+            if (idx >= window_samples * 2)
+                peak_acceleration = std::max(peak_acceleration, fabs(velocity[idx] - velocity[idx - window_samples]) / window_s);
+        }
+        printf("  Axis %zu: %llu steps, %.2f mm, peak velocity %.2f mm/s, peak acceleration %.1f mm/s^2\n",
+            n, (unsigned long long)axis.steps, axis.steps / axis.steps_per_unit, peak_velocity, peak_acceleration);
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s trace [trace...]\n", argv[0]);
+        return 1;
+    }
+    bool ok = true;
+    for(int n=1; n<argc; n++)
+        ok = replay(argv[n]) && ok;
+    return ok ? 0 : 1;
+}